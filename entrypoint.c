@@ -1,32 +1,65 @@
 #include "entrypoint.h"
+#include "escape.h"
+#include "trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Ivanov Ivan");
 MODULE_VERSION("0.01");
 
+struct kmem_cache *networkfs_inode_cachep;
+struct kmem_cache *networkfs_entries_cachep;
+struct kmem_cache *networkfs_content_cachep;
+
+// Number of cached names of @inode other than @except
+unsigned int networkfs_aliases(struct inode *inode, struct dentry *except) {
+  unsigned int count = 0;
+  struct dentry *alias;
+  spin_lock(&inode->i_lock);
+  hlist_for_each_entry(alias, &inode->i_dentry, d_u.d_alias) {
+    if (alias != except && !d_unhashed(alias)) {
+      count++;
+    }
+  }
+  spin_unlock(&inode->i_lock);
+  return count;
+}
+
+// The server does not report link counts, so a file has at least as many
+// links as it has names in dcache
+void networkfs_count_links(struct inode *inode) {
+  unsigned int count = networkfs_aliases(inode, NULL);
+  if (count > inode->i_nlink) {
+    set_nlink(inode, count);
+  }
+}
+
 int networkfs_link(struct dentry *target, struct inode *parent,
                    struct dentry *child) {
   const char *name = child->d_name.name;
   struct inode *inode = d_inode(target);
   if (inode == NULL) {
-    return -1;
+    return -ENOENT;
   }
   char *escaped_name = escape_name(name, strlen(name));
   if (escaped_name == NULL) {
     return -ENOMEM;
   }
-  char number2[8];
+  char number2[21];
   sprintf(number2, "%lu", parent->i_ino);
-  char number1[8];
+  char number1[21];
   sprintf(number1, "%lu", inode->i_ino);
-  int res =
-      networkfs_http_call(parent->i_sb->s_fs_info, "link", NULL, 0, 3, "source",
-                          number1, "parent", number2, "name", escaped_name);
+  int res = networkfs_http_call(&NETWORKFS_SB(parent->i_sb)->client, "link",
+                                NULL, 0, 3, "source", number1, "parent",
+                                number2, "name", escaped_name);
   kfree(escaped_name);
   if (res != 0) {
-    return -1;
+    return networkfs_http_errno(res);
   } else {
-    inode->__i_nlink++;
+    inc_nlink(inode);
+    ihold(inode);
+    networkfs_dir_changed(parent);
+    networkfs_dentry_refresh(child);
+    networkfs_instantiate(child, inode);
     return 0;
   }
 }
@@ -38,128 +71,18 @@ int networkfs_setattr(struct user_namespace *user_ns, struct dentry *entry,
     return ret;
   }
   struct inode *inode = d_inode(entry);
-  if (attr->ia_valid & ATTR_OPEN) {
-    inode->i_size = attr->ia_size;
-  }
-  return 0;
-}
-
-int networkfs_open(struct inode *inode, struct file *filp) {
-  struct content *response =
-      (struct content *)kzalloc(sizeof(struct content), GFP_KERNEL);
-  if (response == NULL) {
-    return -ENOMEM;
-  }
-  char number[8];
-  sprintf(number, "%lu", inode->i_ino);
-  int res =
-      networkfs_http_call(inode->i_sb->s_fs_info, "read", (char *)response,
-                          sizeof(*response), 1, "inode", number);
-  if (res != 0) {
-    kfree(response);
-    return 0;
-  }
-  filp->private_data =
-      (void *)kzalloc(response->content_length + 1, GFP_KERNEL);
-  if (filp->private_data == NULL) {
-    kfree(response);
-    return -ENOMEM;
-  }
-  memcpy(filp->private_data, response->content, response->content_length);
-  inode->i_size = response->content_length;
-  kfree(response);
-  if (filp->f_flags & O_APPEND) {
-    generic_file_llseek(filp, 0, SEEK_END);
-  }
-  return 0;
-}
-
-ssize_t networkfs_read(struct file *filp, char *buffer, size_t len,
-                       loff_t *offset) {
-  if (*offset >= filp->f_inode->i_size) {
-    return 0;
+  if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != i_size_read(inode)) {
+    return networkfs_truncate(inode, attr->ia_size);
   }
-  if (len + *offset >= filp->f_inode->i_size) {
-    len = filp->f_inode->i_size - *offset;
-  }
-  if (copy_to_user(buffer, filp->private_data + *offset, len) != 0) {
-    return -EFAULT;
-  }
-  *offset += len;
-  return len;
-}
-
-ssize_t networkfs_write(struct file *filp, const char *buffer, size_t len,
-                        loff_t *offset) {
-  if (*offset >= MAX_BYTES) {
-    return -EDQUOT;
-  } else if (*offset + len > MAX_BYTES) {
-    len = MAX_BYTES - *offset;
-  }
-  void *temp = filp->private_data;
-  filp->private_data =
-      (char *)kzalloc(len + filp->f_inode->i_size + 1, GFP_KERNEL);
-  if (filp->private_data == NULL) {
-    return -ENOMEM;
-  }
-  memcpy(filp->private_data, temp, filp->f_inode->i_size);
-  kfree(temp);
-  if (copy_from_user(filp->private_data + *offset, buffer, len) != 0) {
-    return -EFAULT;
-  }
-  filp->f_inode->i_size += len;
-  *offset += len;
-  return len;
-}
-
-int networkfs_save_buffer(struct file *filp) {
-  if (filp == NULL || filp->f_inode->i_size == 0) {
-    return 0;
-  }
-  char number[8];
-  sprintf(number, "%lu", filp->f_inode->i_ino);
-  char *escaped_name = escape_name(filp->private_data, filp->f_inode->i_size);
-  if (escaped_name == NULL) {
-    return -ENOMEM;
-  }
-  int res = networkfs_http_call(filp->f_inode->i_sb->s_fs_info, "write", NULL,
-                                0, 2, "inode", number, "content", escaped_name);
-  kfree(escaped_name);
-  if (res != 0) {
-    return -1;
-  }
-  return 0;
-}
-
-int networkfs_flush(struct file *filp, fl_owner_t id) {
-  return networkfs_save_buffer(filp);
-}
-
-int networkfs_fsync(struct file *filp, loff_t begin, loff_t end, int datasync) {
-  return networkfs_save_buffer(filp);
-}
-
-int networkfs_release(struct inode *inode, struct file *filp) {
-  kfree(filp->private_data);
   return 0;
 }
 
 char *escape_name(const char *name, size_t size) {
-  char *escaped_name = (char *)kzalloc(size * 3 + 1, GFP_KERNEL);
+  char *escaped_name = kmalloc(size * 3 + 1, GFP_KERNEL);
   if (escaped_name == NULL) {
     return NULL;
   }
-  int pos = 0;
-  for (int i = 0; i < strlen(name); i++) {
-    if (isalnum(name[i]) || name[i] == '-' || name[i] == '_' ||
-        name[i] == '.' || name[i] == '~') {
-      sprintf((char *)escaped_name + pos, "%c", name[i]);
-      pos++;
-    } else {
-      sprintf((char *)escaped_name + pos, "%%%02X", name[i]);
-      pos += 3;
-    }
-  }
+  escaped_name[networkfs_escape(escaped_name, name, size)] = '\0';
   return escaped_name;
 }
 
@@ -171,35 +94,54 @@ int create_http_call(struct dentry *child, struct inode *parent, umode_t mode,
     return -ENOMEM;
   }
   ino_t ino = 0;
-  char number[8];
+  char number[21];
   sprintf(number, "%lu", parent->i_ino);
-  int res = networkfs_http_call(parent->i_sb->s_fs_info, "create", (char *)&ino,
-                                sizeof(ino_t), 3, "parent", number, "name",
-                                escaped_name, "type",
+  int res = networkfs_http_call(&NETWORKFS_SB(parent->i_sb)->client, "create",
+                                (char *)&ino, sizeof(ino_t), 3, "parent",
+                                number, "name", escaped_name, "type",
                                 type == S_IFREG ? "file" : "directory");
   kfree(escaped_name);
   if (res == 0) {
     struct inode *inode =
         networkfs_get_inode(parent->i_sb, parent, mode | type, ino);
-    d_add(child, inode);
+    if (inode != NULL) {
+      NETWORKFS_I(inode)->data_time = jiffies;  // new file is empty
+    }
+    networkfs_dir_changed(parent);
+    networkfs_dentry_refresh(child);
+    networkfs_instantiate(child, inode);
     return 0;
   } else {
-    return -1;
+    return networkfs_http_errno(res);
   }
 }
 
 int remove_http_call(struct inode *parent, struct dentry *child, char *type) {
   const char *name = child->d_name.name;
-  char number[8];
+  char number[21];
   sprintf(number, "%lu", parent->i_ino);
   char *escaped_name = escape_name(name, strlen(name));
   if (escaped_name == NULL) {
     return -ENOMEM;
   }
-  int res = networkfs_http_call(parent->i_sb->s_fs_info, type, NULL, 0, 2,
-                                "parent", number, "name", escaped_name);
+  int res = networkfs_http_call(&NETWORKFS_SB(parent->i_sb)->client, type,
+                                NULL, 0, 2, "parent", number, "name",
+                                escaped_name);
   kfree(escaped_name);
-  return res == 0 ? 0 : -1;
+  if (res != 0) {
+    return networkfs_http_errno(res);
+  }
+  networkfs_dir_changed(parent);
+
+  // Other names of the inode have to be looked up again
+  struct inode *inode = d_inode(child);
+  if (S_ISDIR(inode->i_mode)) {
+    clear_nlink(inode);
+  } else if (inode->i_nlink > 1 || networkfs_aliases(inode, child) == 0) {
+    drop_nlink(inode);
+  }
+  NETWORKFS_I(inode)->attr_time = 0;
+  return 0;
 }
 
 int networkfs_mkdir(struct user_namespace *user_ns, struct inode *parent,
@@ -220,67 +162,310 @@ int networkfs_create(struct user_namespace *user_ns, struct inode *parent,
   return create_http_call(child, parent, mode, S_IFREG);
 }
 
-int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
-  struct dentry *dentry = filp->f_path.dentry;
+// Adds dentry for an entry of a fresh listing, so that lookups following
+// readdir are served from dcache, and prefetches regular files
+void networkfs_prime_dcache(struct dentry *parent, struct entry *entry) {
+  struct qstr name = QSTR_INIT(entry->name, strlen(entry->name));
+  name.hash = full_name_hash(parent, name.name, name.len);
+  umode_t mode = entry->entry_type == DT_DIR ? S_IFDIR : S_IFREG;
+
+  struct dentry *dentry = d_lookup(parent, &name);
+  if (dentry == NULL) {
+    DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+    dentry = d_alloc_parallel(parent, &name, &wq);
+    if (IS_ERR(dentry)) {
+      return;
+    }
+  }
+
+  if (!d_in_lookup(dentry)) {
+    struct inode *inode = d_inode(dentry);
+    if (inode == NULL) {
+      d_drop(dentry);  // stale negative entry
+    } else if (inode->i_ino == entry->ino &&
+               (inode->i_mode & S_IFMT) == mode) {
+      networkfs_dentry_refresh(dentry);
+      NETWORKFS_I(inode)->attr_time = jiffies;
+      networkfs_prefetch(inode);
+    }
+    dput(dentry);
+    return;
+  }
+
+  struct inode *inode = networkfs_get_inode(parent->d_sb, d_inode(parent),
+                                            mode, entry->ino);
+  networkfs_dentry_refresh(dentry);
+  struct dentry *alias = d_splice_alias(inode, dentry);
+  if (!IS_ERR(alias) && inode != NULL && S_ISREG(mode)) {
+    networkfs_count_links(inode);
+    networkfs_prefetch(inode);
+  }
+  d_lookup_done(dentry);
+  if (!IS_ERR_OR_NULL(alias)) {
+    dput(alias);
+  }
+  dput(dentry);
+}
+
+// Returns listing of the directory, asking the server only if the cached one
+// is too old or the directory was changed since
+int networkfs_get_listing(struct dentry *dentry, struct entries **listing) {
   struct inode *inode = d_inode(dentry);
+  struct networkfs_inode_info *info = NETWORKFS_I(inode);
+  unsigned long version = READ_ONCE(info->dir_version);
+  if (info->listing != NULL && info->listing_version == version &&
+      time_before(jiffies, info->listing_time +
+                               NETWORKFS_SB(inode->i_sb)->entry_timeout)) {
+    networkfs_cache_count(inode->i_sb, NETWORKFS_CACHE_LISTING, true);
+    *listing = info->listing;
+    return 0;
+  }
+  networkfs_cache_count(inode->i_sb, NETWORKFS_CACHE_LISTING, false);
+
   struct entries *response =
-      (struct entries *)kzalloc(sizeof(struct entries), GFP_KERNEL);
+      kmem_cache_alloc(networkfs_entries_cachep, GFP_KERNEL);
   if (response == NULL) {
     return -ENOMEM;
   }
-  char number[8];
+  char number[21];
   sprintf(number, "%lu", inode->i_ino);
-  int res =
-      networkfs_http_call(inode->i_sb->s_fs_info, "list", (char *)response,
-                          sizeof(*response), 1, "inode", number);
+  int res = networkfs_http_call(&NETWORKFS_SB(inode->i_sb)->client, "list",
+                                (char *)response, sizeof(*response), 1, "inode",
+                                number);
   if (res != 0) {
-    kfree(response);
-    return -1;
+    kmem_cache_free(networkfs_entries_cachep, response);
+    return networkfs_http_errno(res);
   }
-  loff_t record_counter = 0;
-  if (ctx->pos < response->entries_count ||
-      (response->entries_count == 0 && ctx->pos == 0)) {
-    dir_emit(ctx, ".", 1, inode->i_ino, DT_DIR);
-    struct inode *parent_inode = dentry->d_parent->d_inode;
-    dir_emit(ctx, "..", 2, parent_inode->i_ino, DT_DIR);
+  if (response->entries_count > ARRAY_SIZE(response->entries)) {
+    kmem_cache_free(networkfs_entries_cachep, response);
+    return -EIO;
   }
-  if (response->entries_count == 0 && ctx->pos == 0) {
-    ctx->pos++;
+
+  if (info->listing != NULL) {
+    kmem_cache_free(networkfs_entries_cachep, info->listing);
+  }
+  info->listing = response;
+  info->listing_version = version;
+  info->listing_time = jiffies;
+
+  for (size_t i = 0; i < response->entries_count; i++) {
+    networkfs_prime_dcache(dentry, &response->entries[i]);
+  }
+
+  *listing = response;
+  return 0;
+}
+
+// Fetches the page of the directory listing starting from the @offset-th entry
+int networkfs_list_page(struct inode *inode, size_t offset,
+                        struct entries_page *page) {
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+  char position[21];
+  sprintf(position, "%zu", offset);
+  int res = networkfs_http_call(&NETWORKFS_SB(inode->i_sb)->client,
+                                "list_page", (char *)page, sizeof(*page), 2,
+                                "inode", number, "offset", position);
+  if (res != 0) {
+    return networkfs_http_errno(res);
+  }
+  if (page->entries_count > NETWORKFS_PAGE_ENTRIES) {
+    return -EIO;
+  }
+  return 0;
+}
+
+// Directory is listed page by page as the position advances, so that only one
+// page is held at a time and the first entries come back right away
+int networkfs_iterate_paged(struct file *filp, struct dir_context *ctx) {
+  struct dentry *dentry = filp->f_path.dentry;
+  if (!dir_emit_dots(filp, ctx)) {
+    return 0;
+  }
+  struct entries_page *page =
+      kmem_cache_alloc(networkfs_entries_cachep, GFP_KERNEL);
+  if (page == NULL) {
+    return -ENOMEM;
+  }
+
+  int res = 0;
+  bool full = false;
+  while (!full) {
+    // Positions 0 and 1 are taken by "." and ".."
+    res = networkfs_list_page(d_inode(dentry), ctx->pos - 2, page);
+    if (res != 0 || page->entries_count == 0) {
+      break;
+    }
+    for (size_t i = 0; i < page->entries_count && !full; i++) {
+      struct entry *entry = &page->entries[i];
+      networkfs_prime_dcache(dentry, entry);
+      full = !dir_emit(ctx, entry->name, strlen(entry->name), entry->ino,
+                       entry->entry_type);
+      if (!full) {
+        ctx->pos++;
+      }
+    }
+    if (ctx->pos - 2 >= page->total_count) {
+      break;
+    }
   }
-  while (ctx->pos < response->entries_count) {
-    dir_emit(ctx, response->entries[ctx->pos].name,
-             strlen(response->entries[ctx->pos].name),
-             response->entries[ctx->pos].ino,
-             response->entries[ctx->pos].entry_type);
-    record_counter++;
-    ctx->pos++;
+  kmem_cache_free(networkfs_entries_cachep, page);
+  return res;
+}
+
+int networkfs_iterate(struct file *filp, struct dir_context *ctx) {
+  ktime_t start = ktime_get();
+  if (NETWORKFS_SB(file_inode(filp)->i_sb)->paged) {
+    int res = networkfs_iterate_paged(filp, ctx);
+    trace_networkfs_iterate(file_inode(filp), ctx->pos, res, start);
+    return res;
+  }
+
+  struct entries *listing;
+  int res = networkfs_get_listing(filp->f_path.dentry, &listing);
+  if (res == 0 && dir_emit_dots(filp, ctx)) {
+    // Positions 0 and 1 are taken by "." and ".."
+    while (ctx->pos - 2 < listing->entries_count) {
+      struct entry *entry = &listing->entries[ctx->pos - 2];
+      if (!dir_emit(ctx, entry->name, strlen(entry->name), entry->ino,
+                    entry->entry_type)) {
+        break;
+      }
+      ctx->pos++;
+    }
   }
-  kfree(response);
-  return record_counter;
+  trace_networkfs_iterate(file_inode(filp), ctx->pos, res, start);
+  return res;
 }
 
 void networkfs_kill_sb(struct super_block *sb) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(sb);
+  // Unmount writes everything back itself
+  cancel_delayed_work_sync(&info->flush_work);
+  networkfs_prefetch_stop(sb);
+  networkfs_debugfs_remove(sb);
+  kill_anon_super(sb);
   printk(KERN_INFO "networkfs: superblock is destroyed %s",
-         (char *)sb->s_fs_info);
-  kfree(sb->s_fs_info);
+         info->client.token);
+  networkfs_http_client_destroy(&info->client);
+  networkfs_http_options_free(&info->http);
+  kfree(info);
 }
 
+struct inode *networkfs_alloc_inode(struct super_block *sb) {
+  struct networkfs_inode_info *info =
+      alloc_inode_sb(sb, networkfs_inode_cachep, GFP_KERNEL);
+  if (info == NULL) {
+    return NULL;
+  }
+  info->attr_time = 0;
+  info->dir_version = 0;
+  info->listing = NULL;
+  info->data_time = 0;
+  info->prefetch = NULL;
+  return &info->vfs_inode;
+}
+
+void networkfs_evict_inode(struct inode *inode) {
+  // Unused inodes stay in inode cache with their pages until reclaimed or
+  // unmounted, then what is left is written back
+  if (inode->i_nlink != 0) {
+    filemap_write_and_wait(inode->i_mapping);
+  }
+  truncate_inode_pages_final(&inode->i_data);
+  clear_inode(inode);
+}
+
+void networkfs_free_inode(struct inode *inode) {
+  if (NETWORKFS_I(inode)->listing != NULL) {
+    kmem_cache_free(networkfs_entries_cachep, NETWORKFS_I(inode)->listing);
+  }
+  kmem_cache_free(networkfs_inode_cachep, NETWORKFS_I(inode));
+}
+
+int networkfs_show_options(struct seq_file *m, struct dentry *root) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(root->d_sb);
+  const struct networkfs_http_options *options = &info->client.options;
+  seq_printf(m, ",server=%pI4,port=%u", &options->addr, options->port);
+  if (options->host != NULL) {
+    seq_show_option(m, "host", options->host);
+  }
+  seq_printf(m, ",connect_timeout=%lu,io_timeout=%lu,max_conns=%u,retries=%u",
+             options->connect_timeout / HZ, options->io_timeout / HZ,
+             options->max_conns, options->retries);
+  seq_printf(m, ",workers=%u", options->workers);
+  seq_printf(m, ",attr_timeout=%lu,entry_timeout=%lu,negative_timeout=%lu",
+             info->attr_timeout / HZ, info->entry_timeout / HZ,
+             info->negative_timeout / HZ);
+  if (info->chunked) {
+    seq_puts(m, ",chunked");
+  }
+  if (info->post) {
+    seq_puts(m, ",post");
+  }
+  if (info->paged) {
+    seq_puts(m, ",paged");
+  }
+  if (info->async_writeback) {
+    seq_puts(m, ",writeback=async");
+  }
+  if (info->prefetch_size != 0) {
+    seq_printf(m, ",prefetch=%u", info->prefetch_size);
+  }
+  return 0;
+}
+
+struct super_operations networkfs_super_ops = {
+    .alloc_inode = networkfs_alloc_inode,
+    .free_inode = networkfs_free_inode,
+    .evict_inode = networkfs_evict_inode,
+    .show_options = networkfs_show_options};
+
 int networkfs_fill_super(struct super_block *sb, struct fs_context *fc) {
+  int error = networkfs_http_client_init(&NETWORKFS_SB(sb)->client, fc->source,
+                                         &NETWORKFS_SB(sb)->http);
+  if (error != 0) {
+    return error;
+  }
+
+  // Own BDI makes page cache of the filesystem subject to writeback
+  error = super_setup_bdi(sb);
+  if (error != 0) {
+    return error;
+  }
+
+  NETWORKFS_SB(sb)->sb = sb;
+  if (NETWORKFS_SB(sb)->async_writeback) {
+    error = bdi_set_max_ratio(sb->s_bdi, NETWORKFS_WRITEBACK_MAX_RATIO);
+    if (error != 0) {
+      return error;
+    }
+  }
+  error = networkfs_prefetch_start(sb);
+  if (error != 0) {
+    return error;
+  }
+
+  sb->s_op = &networkfs_super_ops;
+  sb->s_d_op = &networkfs_dentry_ops;
+  networkfs_debugfs_add(sb);
+
   // Создаём корневую inode
   struct inode *inode = networkfs_get_inode(sb, NULL, S_IFDIR, 1000);
 
   // Создаём корень файловой системы
   sb->s_root = d_make_root(inode);
-  sb->s_fs_info = (char *)kzalloc(strlen(fc->source), GFP_KERNEL);
-  sb->s_maxbytes = MAX_BYTES;
-  if (sb->s_root == NULL || sb->s_fs_info == NULL) {
+  sb->s_maxbytes = NETWORKFS_SB(sb)->chunked ? MAX_LFS_FILESIZE : MAX_BYTES;
+  if (sb->s_root == NULL) {
     return -ENOMEM;
   }
-  memcpy(sb->s_fs_info, fc->source, strlen(fc->source));
   return 0;
 }
 
 int networkfs_get_tree(struct fs_context *fc) {
+  if (fc->source == NULL) {
+    return invalf(fc, "networkfs: token is required");
+  }
   int ret = get_tree_nodev(fc, networkfs_fill_super);
 
   if (ret != 0) {
@@ -290,37 +475,119 @@ int networkfs_get_tree(struct fs_context *fc) {
   return ret;
 }
 
-struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
-                                unsigned int flag) {
-  const char *name = child->d_name.name;
-  struct entry_info *response = &(struct entry_info){0};
-  char number[8];
+int networkfs_lookup_call(struct inode *parent, const struct qstr *name,
+                          struct entry_info *response) {
+  char number[21];
   sprintf(number, "%lu", parent->i_ino);
-  char *escaped_name = escape_name(name, strlen(name));
+  char *escaped_name = escape_name((const char *)name->name, name->len);
   if (escaped_name == NULL) {
-    return NULL;
+    return -ENOMEM;
   }
-  int res = networkfs_http_call(parent->i_sb->s_fs_info, "lookup",
+  int res = networkfs_http_call(&NETWORKFS_SB(parent->i_sb)->client, "lookup",
                                 (char *)response, sizeof(*response), 2,
                                 "parent", number, "name", escaped_name);
   kfree(escaped_name);
+  return res;
+}
+
+struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
+                                unsigned int flag) {
+  struct entry_info *response = &(struct entry_info){0};
+  ktime_t start = ktime_get();
+  int res = networkfs_lookup_call(parent, &child->d_name, response);
+  trace_networkfs_lookup(parent, child->d_name.len, res, start);
+  if (res < 0) {
+    return ERR_PTR(networkfs_http_errno(res));
+  }
   if (res != 0) {
+    // Server has no such entry, remember that until parent is changed
+    child->d_fsdata = (void *)READ_ONCE(NETWORKFS_I(parent)->dir_version);
+    networkfs_dentry_refresh(child);
+    d_add(child, NULL);
     return NULL;
   }
   struct inode *inode = networkfs_get_inode(
       parent->i_sb, parent,
       (response->entry_type == DT_DIR ? S_IFDIR : S_IFREG), response->ino);
-  d_add(child, inode);
-  return NULL;
+  networkfs_dentry_refresh(child);
+  struct dentry *alias = d_splice_alias(inode, child);
+  if (!IS_ERR(alias) && inode != NULL && S_ISREG(inode->i_mode)) {
+    networkfs_count_links(inode);
+  }
+  return alias;
+}
+
+void networkfs_dentry_refresh(struct dentry *dentry) {
+  dentry->d_time = jiffies;
+}
+
+void networkfs_instantiate(struct dentry *dentry, struct inode *inode) {
+  // Dentry is hashed if it was a cached negative one
+  if (d_unhashed(dentry)) {
+    d_add(dentry, inode);
+  } else {
+    d_instantiate(dentry, inode);
+  }
+}
+
+void networkfs_dir_changed(struct inode *dir) {
+  WRITE_ONCE(NETWORKFS_I(dir)->dir_version,
+             NETWORKFS_I(dir)->dir_version + 1);
 }
 
+// Negative entries are not checked on the server, they just expire
+int networkfs_negative_revalidate(struct dentry *dentry) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(dentry->d_sb);
+  struct inode *dir = d_inode_rcu(READ_ONCE(dentry->d_parent));
+  if (dir == NULL) {
+    return 0;
+  }
+  unsigned long version = (unsigned long)dentry->d_fsdata;
+  bool valid = time_before(jiffies, dentry->d_time + info->negative_timeout) &&
+               version == READ_ONCE(NETWORKFS_I(dir)->dir_version);
+  networkfs_cache_count(dentry->d_sb, NETWORKFS_CACHE_NEGATIVE, valid);
+  return valid;
+}
+
+int networkfs_d_revalidate(struct dentry *dentry, unsigned int flags) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(dentry->d_sb);
+  struct inode *inode = d_inode_rcu(dentry);
+  if (inode == NULL) {
+    return networkfs_negative_revalidate(dentry);
+  }
+  unsigned long attr_time = NETWORKFS_I(inode)->attr_time;
+  if (time_before(jiffies, dentry->d_time + info->entry_timeout) &&
+      time_before(jiffies, attr_time + info->attr_timeout)) {
+    networkfs_cache_count(dentry->d_sb, NETWORKFS_CACHE_ENTRY, true);
+    return 1;
+  }
+  if (flags & LOOKUP_RCU) {
+    return -ECHILD;
+  }
+  networkfs_cache_count(dentry->d_sb, NETWORKFS_CACHE_ENTRY, false);
+
+  // Cached entry is too old, make sure it still points to the same inode
+  struct entry_info response;
+  struct dentry *parent = dget_parent(dentry);
+  int res = networkfs_lookup_call(d_inode(parent), &dentry->d_name, &response);
+  dput(parent);
+  if (res < 0) {
+    return networkfs_http_errno(res);
+  }
+  if (res != 0 || response.ino != inode->i_ino ||
+      (response.entry_type == DT_DIR) != S_ISDIR(inode->i_mode)) {
+    return 0;
+  }
+  networkfs_dentry_refresh(dentry);
+  NETWORKFS_I(inode)->attr_time = jiffies;
+  return 1;
+}
+
+struct dentry_operations networkfs_dentry_ops = {.d_revalidate =
+                                                     networkfs_d_revalidate};
+
 struct file_operations networkfs_dir_ops = {.iterate = networkfs_iterate,
-                                            .open = networkfs_open,
-                                            .read = networkfs_read,
-                                            .write = networkfs_write,
-                                            .flush = networkfs_flush,
-                                            .fsync = networkfs_fsync,
-                                            .release = networkfs_release,
+                                            .read = generic_read_dir,
                                             .llseek = generic_file_llseek};
 
 struct inode_operations networkfs_inode_ops = {.lookup = networkfs_lookup,
@@ -333,26 +600,195 @@ struct inode_operations networkfs_inode_ops = {.lookup = networkfs_lookup,
 
 struct inode *networkfs_get_inode(struct super_block *sb,
                                   const struct inode *parent, umode_t mode,
-                                  int i_ino) {
-  struct inode *inode;
-  inode = new_inode(sb);
+                                  ino_t ino) {
+  struct inode *inode = iget_locked(sb, ino);
+  if (inode == NULL) {
+    return NULL;
+  }
+  if (!(inode->i_state & I_NEW)) {
+    if (!inode_wrong_type(inode, mode)) {
+      NETWORKFS_I(inode)->attr_time = jiffies;
+      return inode;
+    }
+    // The number was reused by the server for an entry of another type, the
+    // cached inode is stale
+    remove_inode_hash(inode);
+    iput(inode);
+    inode = iget_locked(sb, ino);
+    if (inode == NULL) {
+      return NULL;
+    }
+  }
 
-  if (inode != NULL) {
-    inode->i_ino = i_ino;
+  if (S_ISDIR(mode)) {
     inode->i_fop = &networkfs_dir_ops;
-    inode->i_op = &networkfs_inode_ops;
-    inode->i_size = 0;
-    inode_init_owner(&init_user_ns, inode, parent,
-                     mode | S_IRWXU | S_IRWXG | S_IRWXO);
+  } else {
+    inode->i_fop = &networkfs_file_ops;
+    inode->i_mapping->a_ops = &networkfs_aops;
+  }
+  inode->i_op = &networkfs_inode_ops;
+  inode->i_size = 0;
+  NETWORKFS_I(inode)->attr_time = jiffies;
+  inode_init_owner(&init_user_ns, inode, parent,
+                   mode | S_IRWXU | S_IRWXG | S_IRWXO);
+  unlock_new_inode(inode);
+  return inode;
+}
+
+enum networkfs_param {
+  Opt_attr_timeout,
+  Opt_entry_timeout,
+  Opt_negative_timeout,
+  Opt_chunked,
+  Opt_post,
+  Opt_paged,
+  Opt_writeback,
+  Opt_prefetch,
+  Opt_server,
+  Opt_port,
+  Opt_host,
+  Opt_connect_timeout,
+  Opt_io_timeout,
+  Opt_max_conns,
+  Opt_retries,
+  Opt_workers
+};
+
+const struct constant_table networkfs_param_writeback[] = {
+    {"sync", false}, {"async", true}, {}};
+
+const struct fs_parameter_spec networkfs_fs_parameters[] = {
+    fsparam_u32("attr_timeout", Opt_attr_timeout),
+    fsparam_u32("entry_timeout", Opt_entry_timeout),
+    fsparam_u32("negative_timeout", Opt_negative_timeout),
+    fsparam_flag("chunked", Opt_chunked),
+    fsparam_flag("post", Opt_post),
+    fsparam_flag("paged", Opt_paged),
+    fsparam_enum("writeback", Opt_writeback, networkfs_param_writeback),
+    fsparam_u32("prefetch", Opt_prefetch),
+    fsparam_string("server", Opt_server),
+    fsparam_u32("port", Opt_port),
+    fsparam_string("host", Opt_host),
+    fsparam_u32("connect_timeout", Opt_connect_timeout),
+    fsparam_u32("io_timeout", Opt_io_timeout),
+    fsparam_u32("max_conns", Opt_max_conns),
+    fsparam_u32("retries", Opt_retries),
+    fsparam_u32("workers", Opt_workers),
+    {}};
+
+// Timeouts are given in seconds and kept in jiffies
+int networkfs_parse_timeout(struct fs_context *fc, struct fs_parameter *param,
+                            u32 seconds, unsigned long *timeout) {
+  if (seconds > MAX_SCHEDULE_TIMEOUT / HZ) {
+    return invalf(fc, "networkfs: %s is too large", param->key);
+  }
+  *timeout = (unsigned long)seconds * HZ;
+  return 0;
+}
+
+int networkfs_parse_param(struct fs_context *fc, struct fs_parameter *param) {
+  struct networkfs_sb_info *info = fc->s_fs_info;
+  struct fs_parse_result result;
+  int opt = fs_parse(fc, networkfs_fs_parameters, param, &result);
+  if (opt < 0) {
+    return opt;
+  }
+
+  switch (opt) {
+    case Opt_attr_timeout:
+      return networkfs_parse_timeout(fc, param, result.uint_32,
+                                     &info->attr_timeout);
+    case Opt_entry_timeout:
+      return networkfs_parse_timeout(fc, param, result.uint_32,
+                                     &info->entry_timeout);
+    case Opt_negative_timeout:
+      return networkfs_parse_timeout(fc, param, result.uint_32,
+                                     &info->negative_timeout);
+    case Opt_chunked:
+      info->chunked = true;
+      break;
+    case Opt_post:
+      info->post = true;
+      break;
+    case Opt_paged:
+      info->paged = true;
+      break;
+    case Opt_writeback:
+      info->async_writeback = result.uint_32;
+      break;
+    case Opt_prefetch:
+      info->prefetch_size = result.uint_32;
+      break;
+    case Opt_server:
+      if (!in4_pton(param->string, -1, (u8 *)&info->http.addr, -1, NULL)) {
+        return invalf(fc, "networkfs: server must be an IPv4 address");
+      }
+      break;
+    case Opt_port:
+      if (result.uint_32 == 0 || result.uint_32 > U16_MAX) {
+        return invalf(fc, "networkfs: invalid port");
+      }
+      info->http.port = result.uint_32;
+      break;
+    case Opt_host:
+      kfree(info->http.host);
+      info->http.host = param->string;
+      param->string = NULL;
+      break;
+    case Opt_connect_timeout:
+      return networkfs_parse_timeout(fc, param, result.uint_32,
+                                     &info->http.connect_timeout);
+    case Opt_io_timeout:
+      return networkfs_parse_timeout(fc, param, result.uint_32,
+                                     &info->http.io_timeout);
+    case Opt_max_conns:
+      if (result.uint_32 == 0) {
+        return invalf(fc, "networkfs: max_conns must be positive");
+      }
+      info->http.max_conns = result.uint_32;
+      break;
+    case Opt_retries:
+      info->http.retries = result.uint_32;
+      break;
+    case Opt_workers:
+      if (result.uint_32 == 0 || result.uint_32 > WQ_MAX_ACTIVE) {
+        return invalf(fc, "networkfs: workers must be between 1 and %d",
+                      WQ_MAX_ACTIVE);
+      }
+      info->http.workers = result.uint_32;
+      break;
   }
+  return 0;
+}
 
-  return inode;
+void networkfs_free_fc(struct fs_context *fc) {
+  struct networkfs_sb_info *info = fc->s_fs_info;
+  if (info != NULL) {
+    networkfs_http_options_free(&info->http);
+    kfree(info);
+  }
 }
 
-struct fs_context_operations networkfs_context_ops = {.get_tree =
-                                                          networkfs_get_tree};
+struct fs_context_operations networkfs_context_ops = {
+    .parse_param = networkfs_parse_param,
+    .get_tree = networkfs_get_tree,
+    .free = networkfs_free_fc};
 
 int networkfs_init_fs_context(struct fs_context *fc) {
+  struct networkfs_sb_info *info =
+      kzalloc(sizeof(struct networkfs_sb_info), GFP_KERNEL);
+  if (info == NULL) {
+    return -ENOMEM;
+  }
+  info->attr_timeout = NETWORKFS_ATTR_TIMEOUT * HZ;
+  info->entry_timeout = NETWORKFS_ENTRY_TIMEOUT * HZ;
+  info->negative_timeout = NETWORKFS_NEGATIVE_TIMEOUT * HZ;
+  INIT_DELAYED_WORK(&info->flush_work, networkfs_flush_work);
+  spin_lock_init(&info->prefetch_lock);
+  INIT_LIST_HEAD(&info->prefetch_lru);
+  networkfs_http_options_init(&info->http);
+
+  fc->s_fs_info = info;
   fc->ops = &networkfs_context_ops;
   return 0;
 }
@@ -360,17 +796,53 @@ int networkfs_init_fs_context(struct fs_context *fc) {
 struct file_system_type networkfs_fs_type = {
     .name = "networkfs",
     .kill_sb = networkfs_kill_sb,
-    .init_fs_context = networkfs_init_fs_context};
+    .init_fs_context = networkfs_init_fs_context,
+    .parameters = networkfs_fs_parameters};
+
+void networkfs_inode_init_once(void *object) {
+  struct networkfs_inode_info *info = object;
+  inode_init_once(&info->vfs_inode);
+}
+
+void networkfs_destroy_caches(void) {
+  kmem_cache_destroy(networkfs_inode_cachep);
+  kmem_cache_destroy(networkfs_entries_cachep);
+  kmem_cache_destroy(networkfs_content_cachep);
+}
 
 int networkfs_init(void) {
-  struct fs_context fsc = {0};
-  networkfs_init_fs_context(&fsc);
-  int ret_code = register_filesystem(&networkfs_fs_type);
+  int ret_code = -ENOMEM;
+  networkfs_inode_cachep = kmem_cache_create(
+      "networkfs_inode_cache", sizeof(struct networkfs_inode_info), 0,
+      SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, networkfs_inode_init_once);
+  networkfs_entries_cachep = kmem_cache_create(
+      "networkfs_entries",
+      max(sizeof(struct entries), sizeof(struct entries_page)), 0,
+      SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, NULL);
+  networkfs_content_cachep = kmem_cache_create(
+      "networkfs_content", sizeof(struct content), 0, SLAB_ACCOUNT, NULL);
+  if (networkfs_inode_cachep == NULL || networkfs_entries_cachep == NULL ||
+      networkfs_content_cachep == NULL) {
+    goto out_caches;
+  }
+  ret_code = networkfs_http_init();
   if (ret_code != 0) {
-    return ret_code;
+    goto out_caches;
+  }
+  networkfs_debugfs_init();
+  ret_code = register_filesystem(&networkfs_fs_type);
+  if (ret_code != 0) {
+    goto out_http;
   }
   printk(KERN_INFO "Hello, World!\n");
   return 0;
+
+out_http:
+  networkfs_debugfs_exit();
+  networkfs_http_exit();
+out_caches:
+  networkfs_destroy_caches();
+  return ret_code;
 }
 
 void networkfs_exit(void) {
@@ -378,6 +850,11 @@ void networkfs_exit(void) {
   if (ret_code != 0) {
     printk(KERN_ERR "Cannot load\n");
   }
+  // Inodes are freed after RCU grace period
+  rcu_barrier();
+  networkfs_debugfs_exit();
+  networkfs_http_exit();
+  networkfs_destroy_caches();
   printk(KERN_INFO "Goodbye!\n");
 }
 
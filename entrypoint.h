@@ -1,21 +1,138 @@
+#include <linux/backing-dev.h>
 #include <linux/ctype.h>
 #include <linux/fs.h>
 #include <linux/fs_context.h>
+#include <linux/fs_parser.h>
+#include <linux/inet.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/seq_file.h>
 #include <linux/uaccess.h>
+#include <linux/workqueue.h>
 
 #include "http.h"
 
 #define MAX_BYTES 512
 
+// Files of "chunked" mounts are stored on the server as sequences of blocks of
+// this size, which are read and written by index
+#define NETWORKFS_BLOCK_SIZE 512
+#define NETWORKFS_BLOCKS_PER_PAGE (PAGE_SIZE / NETWORKFS_BLOCK_SIZE)
+// At most this many block calls are pipelined at once
+#define NETWORKFS_BATCH_BLOCKS 32
+// Reads of more blocks are split into up to this many batches made at once
+#define NETWORKFS_PARALLEL_BATCHES 4
+
+// Default lifetime of cached metadata, in seconds
+#define NETWORKFS_ATTR_TIMEOUT 1
+#define NETWORKFS_ENTRY_TIMEOUT 1
+#define NETWORKFS_NEGATIVE_TIMEOUT 1
+
+// With writeback=async, dirty files are written back this long after close
+#define NETWORKFS_WRITEBACK_DELAY HZ
+
+// With writeback=async, percentage of the dirty page limit the filesystem may
+// use, as in FUSE, so that a slow server does not hold up writers of others
+#define NETWORKFS_WRITEBACK_MAX_RATIO 1
+
+// With prefetch=, at most this many files are read at once and this many more
+// wait in the queue; at most this many bytes of page cache of prefetched files
+// are kept until they are opened or expire after attr_timeout, the least
+// recently prefetched go first
+#define NETWORKFS_PREFETCH_CONCURRENCY 8
+#define NETWORKFS_PREFETCH_QUEUE 256
+#define NETWORKFS_PREFETCH_MEMORY (4 << 20)
+
+enum networkfs_cache {
+  NETWORKFS_CACHE_ENTRY,     // positive dentries
+  NETWORKFS_CACHE_NEGATIVE,  // negative dentries
+  NETWORKFS_CACHE_LISTING,   // directory listings
+  NETWORKFS_CACHE_DATA,      // page cache of regular files, checked on open
+  NETWORKFS_CACHES
+};
+
+// Hits and misses of a cache, a miss is counted when the cached value is
+// absent, expired or invalidated and has to be fetched from the server
+struct networkfs_cache_stats {
+  atomic64_t hits[NETWORKFS_CACHES];
+  atomic64_t misses[NETWORKFS_CACHES];
+};
+
+struct networkfs_sb_info {
+  struct networkfs_http_client client;
+  struct networkfs_http_options http;  // parsed options, copied into client
+  unsigned long attr_timeout;      // in jiffies
+  unsigned long entry_timeout;     // in jiffies
+  unsigned long negative_timeout;  // in jiffies
+  bool chunked;  // files are accessed by blocks, see NETWORKFS_BLOCK_SIZE
+  bool post;     // file content is sent as raw POST bodies
+  bool paged;    // directories are listed by pages, see struct entries_page
+  // With writeback=async close does not wait for the upload: flush_work is
+  // queued instead, and writes back all dirty files at once. Periodic flushing
+  // and throttling of writers are left to the BDI of the superblock, whose
+  // share of dirty memory is capped by NETWORKFS_WRITEBACK_MAX_RATIO
+  bool async_writeback;
+  struct delayed_work flush_work;
+  // With prefetch=<bytes>, first pages of files up to this size are read on
+  // prefetch_wq when readdir finds them, see prefetch.c
+  unsigned int prefetch_size;
+  struct workqueue_struct *prefetch_wq;
+  struct delayed_work prefetch_expire;  // drops expired files from the LRU
+  spinlock_t prefetch_lock;             // protects the fields below
+  struct list_head prefetch_lru;  // prefetched and not opened, oldest first
+  size_t prefetch_queued;         // files waiting for prefetch_wq
+  size_t prefetch_memory;         // page cache held by prefetch_lru, in bytes
+  bool prefetch_stopping;         // queued files are skipped on unmount
+  struct super_block *sb;
+  struct networkfs_cache_stats cache_stats;
+  struct dentry *debugfs;  // directory of the mount in debugfs
+};
+
+#define NETWORKFS_SB(sb) ((struct networkfs_sb_info *)(sb)->s_fs_info)
+
+struct networkfs_inode_info {
+  unsigned long attr_time;  // when attributes were last fetched, in jiffies
+  // Incremented on every local change of directory entries, negative
+  // dentries made before the change are not trusted
+  unsigned long dir_version;
+  // Cached result of "list" for directories, protected by inode lock
+  struct entries *listing;
+  unsigned long listing_time;  // in jiffies
+  unsigned long listing_version;
+  // When page cache of a regular file was last synchronized with the server,
+  // in jiffies; zero if it never was
+  unsigned long data_time;
+  // Pending or completed prefetch of a regular file which was not opened yet,
+  // protected by prefetch_lock of the superblock
+  struct networkfs_prefetch *prefetch;
+  struct inode vfs_inode;
+};
+
+#define NETWORKFS_I(inode) \
+  container_of(inode, struct networkfs_inode_info, vfs_inode)
+
+extern struct kmem_cache *networkfs_inode_cachep;
+// Responses of "list", "list_page" and "read", sized to fit the objects exactly
+// rather than the next power of two
+extern struct kmem_cache *networkfs_entries_cachep;
+extern struct kmem_cache *networkfs_content_cachep;
+
+extern struct dentry_operations networkfs_dentry_ops;
+
 struct dentry *networkfs_lookup(struct inode *parent, struct dentry *child,
                                 unsigned int flag);
 
+void networkfs_dentry_refresh(struct dentry *dentry);
+
+void networkfs_instantiate(struct dentry *dentry, struct inode *inode);
+
+void networkfs_dir_changed(struct inode *dir);
+
+// Returns the cached inode of server inode @ino, or a new one
 struct inode *networkfs_get_inode(struct super_block *sb,
                                   const struct inode *parent, umode_t mode,
-                                  int i_ino);
+                                  ino_t ino);
 
 char *escape_name(const char *name, size_t size);
 
@@ -24,13 +141,25 @@ int remove_http_call(struct inode *parent, struct dentry *child, char *type);
 int create_http_call(struct dentry *child, struct inode *parent, umode_t mode,
                      int type);
 
-int networkfs_save_buffer(struct file *filp);
+int networkfs_save_buffer(struct inode *inode, const char *buffer,
+                          size_t size);
+
+int networkfs_truncate(struct inode *inode, loff_t size);
+
+void networkfs_flush_work(struct work_struct *work);
+
+extern struct file_operations networkfs_file_ops;
+
+extern struct address_space_operations networkfs_aops;
 
 struct entry_info {
   unsigned char entry_type;  // DT_DIR (4) or DT_REG (8)
   ino_t ino;
 };
 
+int networkfs_lookup_call(struct inode *parent, const struct qstr *name,
+                          struct entry_info *response);
+
 struct entries {
   size_t entries_count;
   struct entry {
@@ -40,7 +169,61 @@ struct entries {
   } entries[16];
 };
 
+// Response of "list_page?inode=&offset=": at most NETWORKFS_PAGE_ENTRIES
+// entries of the directory starting from the offset-th one, in a stable order
+#define NETWORKFS_PAGE_ENTRIES 16
+
+struct entries_page {
+  size_t entries_count;
+  size_t total_count;  // entries in the whole directory
+  struct entry entries[NETWORKFS_PAGE_ENTRIES];
+};
+
 struct content {
   __u64 content_length;
   char content[MAX_BYTES];
-};
\ No newline at end of file
+};
+
+int networkfs_read_call(struct inode *inode, struct content *response);
+
+struct content_block {
+  __u64 file_size;
+  __u64 length;  // less than NETWORKFS_BLOCK_SIZE only for the last block
+  char content[NETWORKFS_BLOCK_SIZE];
+};
+
+int networkfs_read_blocks(struct inode *inode, u64 first, size_t count,
+                          char *buffer, loff_t *size);
+
+int networkfs_write_blocks(struct inode *inode, u64 first, size_t count,
+                           const char *buffer, loff_t size);
+
+// Whether page cache of @inode was synchronized with the server recently
+bool networkfs_data_fresh(struct inode *inode);
+
+// Reads the first page of @inode from the server, dropping the rest of page
+// cache unless it has local changes
+int networkfs_fetch_data(struct inode *inode);
+
+// Queues reading of the regular file @inode found by readdir if the mount has
+// prefetch enabled
+void networkfs_prefetch(struct inode *inode);
+
+// Removes @inode from the prefetched ones when it is opened
+void networkfs_prefetch_forget(struct inode *inode);
+
+int networkfs_prefetch_start(struct super_block *sb);
+
+void networkfs_prefetch_stop(struct super_block *sb);
+
+void networkfs_cache_count(struct super_block *sb, enum networkfs_cache cache,
+                           bool hit);
+
+// Statistics are exported in /sys/kernel/debug/networkfs/<dev>/stats
+void networkfs_debugfs_init(void);
+
+void networkfs_debugfs_exit(void);
+
+void networkfs_debugfs_add(struct super_block *sb);
+
+void networkfs_debugfs_remove(struct super_block *sb);
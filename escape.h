@@ -0,0 +1,54 @@
+#ifndef NETWORKFS_ESCAPE
+#define NETWORKFS_ESCAPE
+
+// Shared with user space benchmarks, hence no kernel-only dependencies
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#endif
+
+// Characters sent as is, which are unreserved in terms of RFC 3986, the rest
+// is percent-encoded
+static const unsigned char NETWORKFS_UNRESERVED[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x00
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x10
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,  // 0x20
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,  // 0x30
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,  // 0x50
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,  // 0x70
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x80
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x90
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xA0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xB0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xC0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xD0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xE0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0xF0
+};
+
+static const char NETWORKFS_HEX[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
+                                       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+
+// Percent-encodes @size bytes of @name into @escaped, which has to hold
+// 3 * @size bytes. Returns length of the result, which is not terminated.
+static inline size_t networkfs_escape(char *escaped, const char *name,
+                                      size_t size) {
+  char *out = escaped;
+  for (size_t i = 0; i < size; i++) {
+    unsigned char c = name[i];
+    if (NETWORKFS_UNRESERVED[c]) {
+      *out++ = c;
+    } else {
+      *out++ = '%';
+      *out++ = NETWORKFS_HEX[c >> 4];
+      *out++ = NETWORKFS_HEX[c & 0xF];
+    }
+  }
+  return out - escaped;
+}
+
+#endif
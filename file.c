@@ -0,0 +1,632 @@
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+
+#include "entrypoint.h"
+#include "escape.h"
+#include "trace.h"
+
+int networkfs_read_call(struct inode *inode, struct content *response) {
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+  int res = networkfs_http_call(&NETWORKFS_SB(inode->i_sb)->client, "read",
+                                (char *)response, sizeof(*response), 1, "inode",
+                                number);
+  // Content longer than the response could hold is a protocol violation
+  if (res == 0 && response->content_length > MAX_BYTES) {
+    return -EIO;
+  }
+  return res;
+}
+
+int networkfs_save_buffer(struct inode *inode, const char *buffer,
+                          size_t size) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(inode->i_sb);
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+  ktime_t start = ktime_get();
+  int res;
+  if (info->post) {
+    res = networkfs_http_post(&info->client, "write", NULL, 0, buffer, size,
+                              1, "inode", number);
+  } else {
+    char *escaped_name = escape_name(buffer, size);
+    if (escaped_name == NULL) {
+      return -ENOMEM;
+    }
+    res = networkfs_http_call(&info->client, "write", NULL, 0, 2, "inode",
+                              number, "content", escaped_name);
+    kfree(escaped_name);
+  }
+  trace_networkfs_save_buffer(inode, size, res, start);
+  if (res != 0) {
+    return networkfs_http_errno(res);
+  }
+  return 0;
+}
+
+int networkfs_truncate_call(struct inode *inode, loff_t size) {
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+  char length[21];
+  sprintf(length, "%lld", size);
+  int res = networkfs_http_call(&NETWORKFS_SB(inode->i_sb)->client,
+                                "truncate", NULL, 0, 2, "inode", number,
+                                "size", length);
+  if (res != 0) {
+    return networkfs_http_errno(res);
+  }
+  return 0;
+}
+
+// Calls for a batch of consecutive blocks, too big for the stack
+struct networkfs_block_batch {
+  struct networkfs_http_async async;
+  struct networkfs_http_request requests[NETWORKFS_BATCH_BLOCKS];
+  const char *args[NETWORKFS_BATCH_BLOCKS][6];
+  char indices[NETWORKFS_BATCH_BLOCKS][21];
+  union {
+    struct content_block blocks[NETWORKFS_BATCH_BLOCKS];
+    char escaped[NETWORKFS_BATCH_BLOCKS][3 * NETWORKFS_BLOCK_SIZE + 1];
+  };
+};
+
+// Without "chunked" the whole file is a single block read by "read"
+int networkfs_read_whole(struct inode *inode, size_t count, char *buffer,
+                         loff_t *size) {
+  struct content *response =
+      kmem_cache_alloc(networkfs_content_cachep, GFP_KERNEL);
+  if (response == NULL) {
+    return -ENOMEM;
+  }
+  int res = networkfs_read_call(inode, response);
+  if (res == 0) {
+    size_t length = min_t(size_t, response->content_length,
+                          count * NETWORKFS_BLOCK_SIZE);
+    memcpy(buffer, response->content, length);
+    memset(buffer + length, 0, count * NETWORKFS_BLOCK_SIZE - length);
+    *size = response->content_length;
+  }
+  kmem_cache_free(networkfs_content_cachep, response);
+  if (res != 0) {
+    return networkfs_http_errno(res);
+  }
+  return 0;
+}
+
+// Fills @batch with calls reading @count blocks from @first
+void networkfs_read_batch_init(struct networkfs_block_batch *batch,
+                               const char *number, u64 first, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    sprintf(batch->indices[i], "%llu", first + i);
+    batch->args[i][0] = "inode";
+    batch->args[i][1] = number;
+    batch->args[i][2] = "block";
+    batch->args[i][3] = batch->indices[i];
+    batch->requests[i] = (struct networkfs_http_request){
+        .method = "read_block",
+        .response_buffer = (char *)&batch->blocks[i],
+        .buffer_size = sizeof(struct content_block),
+        .arg_size = 2,
+        .args = batch->args[i]};
+  }
+  batch->async = (struct networkfs_http_async){.requests = batch->requests,
+                                               .count = count};
+}
+
+// Copies blocks read by @batch into @buffer
+int networkfs_read_batch_copy(struct networkfs_block_batch *batch,
+                              char *buffer, loff_t *size) {
+  for (size_t i = 0; i < batch->async.count; i++) {
+    int64_t res = batch->requests[i].result;
+    if (res != 0) {
+      return networkfs_http_errno(res);
+    }
+    // Blocks past the end of file come back empty
+    struct content_block *block = &batch->blocks[i];
+    size_t length = min_t(size_t, block->length, NETWORKFS_BLOCK_SIZE);
+    char *destination = buffer + i * NETWORKFS_BLOCK_SIZE;
+    memcpy(destination, block->content, length);
+    memset(destination + length, 0, NETWORKFS_BLOCK_SIZE - length);
+    *size = block->file_size;
+  }
+  return 0;
+}
+
+int networkfs_read_blocks(struct inode *inode, u64 first, size_t count,
+                          char *buffer, loff_t *size) {
+  if (!NETWORKFS_SB(inode->i_sb)->chunked) {
+    return networkfs_read_whole(inode, count, buffer, size);
+  }
+
+  // Up to NETWORKFS_PARALLEL_BATCHES batches are made at once: the first by
+  // the caller, the rest by workers of the client
+  struct networkfs_http_client *client = &NETWORKFS_SB(inode->i_sb)->client;
+  size_t batches = min_t(size_t, DIV_ROUND_UP(count, NETWORKFS_BATCH_BLOCKS),
+                         NETWORKFS_PARALLEL_BATCHES);
+  struct networkfs_block_batch *batch = kvmalloc_array(
+      batches, sizeof(struct networkfs_block_batch), GFP_KERNEL);
+  if (batch == NULL) {
+    return -ENOMEM;
+  }
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+
+  int error = 0;
+  for (size_t done = 0; done < count && error == 0;) {
+    size_t round =
+        min_t(size_t, count - done, batches * NETWORKFS_BATCH_BLOCKS);
+    size_t used = DIV_ROUND_UP(round, NETWORKFS_BATCH_BLOCKS);
+    for (size_t i = 0; i < used; i++) {
+      size_t offset = i * NETWORKFS_BATCH_BLOCKS;
+      networkfs_read_batch_init(
+          &batch[i], number, first + done + offset,
+          min_t(size_t, round - offset, NETWORKFS_BATCH_BLOCKS));
+      if (i > 0) {
+        networkfs_http_submit(client, &batch[i].async);
+      }
+    }
+    networkfs_http_call_batch(client, batch[0].requests, batch[0].async.count);
+
+    // Every submitted batch has to be waited for, even after a failure
+    for (size_t i = 0; i < used; i++) {
+      if (i > 0) {
+        networkfs_http_wait(&batch[i].async);
+      }
+      char *destination =
+          buffer + (done + i * NETWORKFS_BATCH_BLOCKS) * NETWORKFS_BLOCK_SIZE;
+      int res = networkfs_read_batch_copy(&batch[i], destination, size);
+      if (error == 0) {
+        error = res;
+      }
+    }
+    done += round;
+  }
+  kvfree(batch);
+  return error;
+}
+
+int networkfs_write_blocks(struct inode *inode, u64 first, size_t count,
+                           const char *buffer, loff_t size) {
+  if (!NETWORKFS_SB(inode->i_sb)->chunked) {
+    // The only block is the whole file, which is bounded by s_maxbytes
+    return networkfs_save_buffer(inode, buffer, min_t(loff_t, size, MAX_BYTES));
+  }
+
+  struct networkfs_block_batch *batch =
+      kvmalloc(sizeof(struct networkfs_block_batch), GFP_KERNEL);
+  if (batch == NULL) {
+    return -ENOMEM;
+  }
+  char number[21];
+  sprintf(number, "%lu", inode->i_ino);
+
+  int error = 0;
+  for (size_t done = 0; done < count && error == 0;) {
+    size_t batch_size = min_t(size_t, count - done, NETWORKFS_BATCH_BLOCKS);
+    for (size_t i = 0; i < batch_size; i++) {
+      u64 index = first + done + i;
+      loff_t offset = index * NETWORKFS_BLOCK_SIZE;
+      size_t length = min_t(loff_t, size - offset, NETWORKFS_BLOCK_SIZE);
+      const char *content = buffer + (done + i) * NETWORKFS_BLOCK_SIZE;
+      sprintf(batch->indices[i], "%llu", index);
+      batch->args[i][0] = "inode";
+      batch->args[i][1] = number;
+      batch->args[i][2] = "block";
+      batch->args[i][3] = batch->indices[i];
+      batch->requests[i] =
+          (struct networkfs_http_request){.method = "write_block",
+                                          .response_buffer = NULL,
+                                          .buffer_size = 0,
+                                          .arg_size = 2,
+                                          .args = batch->args[i]};
+      if (NETWORKFS_SB(inode->i_sb)->post) {
+        batch->requests[i].encoding = NETWORKFS_HTTP_RAW;
+        batch->requests[i].body = content;
+        batch->requests[i].body_size = length;
+      } else {
+        char *escaped = batch->escaped[i];
+        escaped[networkfs_escape(escaped, content, length)] = '\0';
+        batch->args[i][4] = "content";
+        batch->args[i][5] = escaped;
+        batch->requests[i].arg_size = 3;
+      }
+    }
+    networkfs_http_call_batch(&NETWORKFS_SB(inode->i_sb)->client,
+                              batch->requests, batch_size);
+    for (size_t i = 0; i < batch_size && error == 0; i++) {
+      if (batch->requests[i].result != 0) {
+        error = networkfs_http_errno(batch->requests[i].result);
+      }
+    }
+    done += batch_size;
+  }
+  kvfree(batch);
+  return error;
+}
+
+// Number of blocks of the page at @index which lie before the end of file
+size_t networkfs_page_blocks(struct inode *inode, pgoff_t index) {
+  loff_t size = i_size_read(inode);
+  loff_t offset = (loff_t)index << PAGE_SHIFT;
+  if (offset >= size) {
+    return 0;
+  }
+  return min_t(loff_t, DIV_ROUND_UP(size - offset, NETWORKFS_BLOCK_SIZE),
+               NETWORKFS_BLOCKS_PER_PAGE);
+}
+
+void networkfs_fill_page(struct page *page, const char *data) {
+  memcpy_to_page(page, 0, data, PAGE_SIZE);
+  SetPageUptodate(page);
+}
+
+int networkfs_read_folio(struct file *filp, struct folio *folio) {
+  ktime_t start = ktime_get();
+  struct inode *inode = folio->mapping->host;
+  char *buffer = kmalloc(PAGE_SIZE, GFP_KERNEL);
+  size_t count = networkfs_page_blocks(inode, folio->index);
+  loff_t size;
+  int res = buffer == NULL ? -ENOMEM : 0;
+  if (res == 0) {
+    // Only the part past the end of file is not overwritten
+    memset(buffer + count * NETWORKFS_BLOCK_SIZE, 0,
+           PAGE_SIZE - count * NETWORKFS_BLOCK_SIZE);
+  }
+  if (res == 0 && count > 0) {
+    res = networkfs_read_blocks(
+        inode, (u64)folio->index * NETWORKFS_BLOCKS_PER_PAGE, count, buffer,
+        &size);
+  }
+  if (res == 0) {
+    networkfs_fill_page(&folio->page, buffer);
+  }
+  kfree(buffer);
+  folio_unlock(folio);
+  trace_networkfs_read(inode, count * NETWORKFS_BLOCK_SIZE, res, start);
+  return res;
+}
+
+void networkfs_readahead(struct readahead_control *rac) {
+  ktime_t start = ktime_get();
+  struct inode *inode = rac->mapping->host;
+  pgoff_t index = readahead_index(rac);
+  size_t pages = readahead_count(rac);
+  size_t count = 0;
+  for (size_t i = 0; i < pages; i++) {
+    count += networkfs_page_blocks(inode, index + i);
+  }
+
+  // Blocks of the whole window are requested in one go
+  char *buffer = kvmalloc(pages * PAGE_SIZE, GFP_KERNEL);
+  loff_t size;
+  int res = buffer == NULL ? -ENOMEM : 0;
+  if (res == 0) {
+    memset(buffer + count * NETWORKFS_BLOCK_SIZE, 0,
+           pages * PAGE_SIZE - count * NETWORKFS_BLOCK_SIZE);
+  }
+  if (res == 0 && count > 0) {
+    res = networkfs_read_blocks(inode,
+                                (u64)index * NETWORKFS_BLOCKS_PER_PAGE,
+                                count, buffer, &size);
+  }
+
+  struct folio *folio;
+  while ((folio = readahead_folio(rac)) != NULL) {
+    if (res == 0) {
+      networkfs_fill_page(&folio->page,
+                          buffer + (folio->index - index) * PAGE_SIZE);
+    }
+    folio_unlock(folio);
+  }
+  kvfree(buffer);
+  trace_networkfs_read(inode, count * NETWORKFS_BLOCK_SIZE, res, start);
+}
+
+// Blocks of a page changed since it was last written back are tracked in a
+// bitmask stored as its private data, so that only they are uploaded
+void networkfs_add_dirty_blocks(struct folio *folio, unsigned long blocks) {
+  unsigned long dirty = (unsigned long)folio_get_private(folio) | blocks;
+  if (folio_test_private(folio)) {
+    folio_change_private(folio, (void *)dirty);
+  } else {
+    folio_attach_private(folio, (void *)dirty);
+  }
+}
+
+void networkfs_dirty_blocks(struct folio *folio, size_t offset,
+                            size_t length) {
+  BUILD_BUG_ON(NETWORKFS_BLOCKS_PER_PAGE > BITS_PER_LONG);
+  networkfs_add_dirty_blocks(
+      folio, GENMASK((offset + length - 1) / NETWORKFS_BLOCK_SIZE,
+                     offset / NETWORKFS_BLOCK_SIZE));
+}
+
+// Pages dirtied without a known range are written back as a whole
+unsigned long networkfs_take_dirty_blocks(struct folio *folio) {
+  unsigned long dirty = (unsigned long)folio_detach_private(folio);
+  return dirty != 0 ? dirty : GENMASK(NETWORKFS_BLOCKS_PER_PAGE - 1, 0);
+}
+
+int networkfs_write_begin(struct file *filp, struct address_space *mapping,
+                          loff_t pos, unsigned len, struct page **pagep,
+                          void **fsdata) {
+  pgoff_t index = pos >> PAGE_SHIFT;
+  struct page *page;
+  while (true) {
+    page = grab_cache_page_write_begin(mapping, index);
+    if (page == NULL) {
+      return -ENOMEM;
+    }
+    if (PageUptodate(page) || len == PAGE_SIZE) {
+      break;
+    }
+    if (page_offset(page) >= i_size_read(mapping->host)) {
+      // Nothing is stored on the server past the end of file
+      zero_user(page, 0, PAGE_SIZE);
+      SetPageUptodate(page);
+      break;
+    }
+    int error = networkfs_read_folio(filp, page_folio(page));
+    put_page(page);
+    if (error != 0) {
+      return error;
+    }
+  }
+  *pagep = page;
+  return 0;
+}
+
+int networkfs_write_end(struct file *filp, struct address_space *mapping,
+                        loff_t pos, unsigned len, unsigned copied,
+                        struct page *page, void *fsdata) {
+  struct inode *inode = mapping->host;
+  if (!PageUptodate(page)) {
+    // Page was not read as it had to be overwritten completely
+    if (copied < len) {
+      copied = 0;
+      goto out;
+    }
+    SetPageUptodate(page);
+  }
+
+  if (copied == 0) {
+    goto out;
+  }
+  if (pos + copied > inode->i_size) {
+    i_size_write(inode, pos + copied);
+  }
+  networkfs_dirty_blocks(page_folio(page), offset_in_page(pos), copied);
+  set_page_dirty(page);
+
+out:
+  unlock_page(page);
+  put_page(page);
+  return copied;
+}
+
+// Uploads dirty blocks of a page which lie before the end of file. The page
+// comes locked and cleaned by write_cache_pages, @data is a page-sized buffer
+int networkfs_writepage(struct page *page, struct writeback_control *wbc,
+                        void *data) {
+  struct folio *folio = page_folio(page);
+  struct inode *inode = folio->mapping->host;
+  char *buffer = data;
+  folio_start_writeback(folio);
+  unsigned long dirty = networkfs_take_dirty_blocks(folio);
+  loff_t size = i_size_read(inode);
+  size_t count = networkfs_page_blocks(inode, folio->index);
+  memcpy_from_page(buffer, page, 0, PAGE_SIZE);
+  folio_unlock(folio);
+
+  // Without "chunked" the file can only be uploaded as a whole
+  size_t first = 0;
+  if (NETWORKFS_SB(inode->i_sb)->chunked && count > 0) {
+    first = __ffs(dirty);
+    count = min_t(size_t, count, __fls(dirty) + 1);
+  }
+
+  ktime_t start = ktime_get();
+  int error = 0;
+  if (first < count) {
+    error = networkfs_write_blocks(
+        inode, (u64)folio->index * NETWORKFS_BLOCKS_PER_PAGE + first,
+        count - first, buffer + first * NETWORKFS_BLOCK_SIZE, size);
+  }
+  trace_networkfs_write(
+      inode, first < count ? (count - first) * NETWORKFS_BLOCK_SIZE : 0, error,
+      start);
+  if (error == -ENOMEM || networkfs_http_transient(error)) {
+    // Kept dirty to be retried, rather than marked clean and then replaced by
+    // the content of the server
+    folio_lock(folio);
+    networkfs_add_dirty_blocks(folio, dirty);
+    folio_redirty_for_writepage(wbc, folio);
+    folio_unlock(folio);
+  }
+  if (error != 0) {
+    mapping_set_error(inode->i_mapping, error);
+  }
+  folio_end_writeback(folio);
+  return error;
+}
+
+// Only dirty pages in the range of @wbc are written back, each of them as the
+// blocks it consists of
+int networkfs_writepages(struct address_space *mapping,
+                         struct writeback_control *wbc) {
+  char *buffer = kmalloc(PAGE_SIZE, GFP_NOFS);
+  if (buffer == NULL) {
+    return -ENOMEM;
+  }
+  int error = write_cache_pages(mapping, wbc, networkfs_writepage, buffer);
+  kfree(buffer);
+  return error;
+}
+
+void networkfs_invalidate_folio(struct folio *folio, size_t offset,
+                                size_t length) {
+  if (offset == 0 && length == folio_size(folio)) {
+    folio_detach_private(folio);
+  }
+}
+
+bool networkfs_release_folio(struct folio *folio, gfp_t gfp) {
+  folio_detach_private(folio);
+  return true;
+}
+
+struct address_space_operations networkfs_aops = {
+    .read_folio = networkfs_read_folio,
+    .readahead = networkfs_readahead,
+    .write_begin = networkfs_write_begin,
+    .write_end = networkfs_write_end,
+    .writepages = networkfs_writepages,
+    .dirty_folio = filemap_dirty_folio,
+    .invalidate_folio = networkfs_invalidate_folio,
+    .release_folio = networkfs_release_folio,
+    .migrate_folio = filemap_migrate_folio};
+
+bool networkfs_data_fresh(struct inode *inode) {
+  unsigned long data_time = READ_ONCE(NETWORKFS_I(inode)->data_time);
+  unsigned long timeout = NETWORKFS_SB(inode->i_sb)->attr_timeout;
+  return data_time != 0 && time_before(jiffies, data_time + timeout);
+}
+
+int networkfs_fetch_data(struct inode *inode) {
+  struct networkfs_inode_info *info = NETWORKFS_I(inode);
+  char *buffer = kmalloc(PAGE_SIZE, GFP_KERNEL);
+  if (buffer == NULL) {
+    return -ENOMEM;
+  }
+
+  // Only the first page is fetched, the rest is read when it is accessed
+  inode_lock(inode);
+  loff_t size;
+  int res = 0;
+  // Local changes which are not written back yet are newer, so the content of
+  // the server is not needed until they are
+  if (mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY)) {
+    info->data_time = jiffies;
+    goto out;
+  }
+  res = networkfs_read_blocks(inode, 0, NETWORKFS_BLOCKS_PER_PAGE, buffer,
+                              &size);
+  // Pages may have been dirtied through a mapping in the meantime
+  if (res != 0 || mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY)) {
+    goto out;
+  }
+  // Pages which could not be dropped would stay stale
+  res = invalidate_inode_pages2(inode->i_mapping);
+  if (res == 0) {
+    i_size_write(inode, size);
+    struct page *page = grab_cache_page(inode->i_mapping, 0);
+    if (page != NULL) {
+      networkfs_fill_page(page, buffer);
+      unlock_page(page);
+      put_page(page);
+    }
+    info->data_time = jiffies;
+    info->attr_time = jiffies;
+  }
+
+out:
+  inode_unlock(inode);
+
+  kfree(buffer);
+  return res;
+}
+
+// Brings page cache in sync with the server if cached content is too old
+int networkfs_revalidate_data(struct inode *inode) {
+  bool fresh = networkfs_data_fresh(inode);
+  networkfs_cache_count(inode->i_sb, NETWORKFS_CACHE_DATA, fresh);
+  return fresh ? 0 : networkfs_fetch_data(inode);
+}
+
+int networkfs_open(struct inode *inode, struct file *filp) {
+  ktime_t start = ktime_get();
+  networkfs_prefetch_forget(inode);
+  int res = networkfs_revalidate_data(inode);
+  trace_networkfs_open(inode, i_size_read(inode), res, start);
+  return res;
+}
+
+// Pages dirtied through a shared mapping may have changed anywhere
+vm_fault_t networkfs_page_mkwrite(struct vm_fault *vmf) {
+  vm_fault_t ret = filemap_page_mkwrite(vmf);
+  if (ret & VM_FAULT_LOCKED) {
+    networkfs_dirty_blocks(page_folio(vmf->page), 0, PAGE_SIZE);
+  }
+  return ret;
+}
+
+const struct vm_operations_struct networkfs_file_vm_ops = {
+    .fault = filemap_fault,
+    .map_pages = filemap_map_pages,
+    .page_mkwrite = networkfs_page_mkwrite};
+
+int networkfs_mmap(struct file *filp, struct vm_area_struct *vma) {
+  file_accessed(filp);
+  vma->vm_ops = &networkfs_file_vm_ops;
+  return 0;
+}
+
+// Dirty pages are the dirty state of a file: clean files are not uploaded,
+// and an fsync leaves nothing for the following close to write back
+int networkfs_fsync(struct file *filp, loff_t begin, loff_t end, int datasync) {
+  return file_write_and_wait_range(filp, begin, end);
+}
+
+void networkfs_flush_work(struct work_struct *work) {
+  struct networkfs_sb_info *info =
+      container_of(to_delayed_work(work), struct networkfs_sb_info, flush_work);
+  // Fails only while the filesystem is being unmounted, which syncs it anyway
+  try_to_writeback_inodes_sb(info->sb, WB_REASON_SYNC);
+}
+
+int networkfs_flush(struct file *filp, fl_owner_t id) {
+  // Read-only opens neither dirty pages nor wait for others to write them
+  if (!(filp->f_mode & FMODE_WRITE)) {
+    return 0;
+  }
+
+  struct networkfs_sb_info *info = NETWORKFS_SB(file_inode(filp)->i_sb);
+  if (info->async_writeback) {
+    // Closes within the delay are written back together, errors are left
+    // for fsync to report
+    queue_delayed_work(system_unbound_wq, &info->flush_work,
+                       NETWORKFS_WRITEBACK_DELAY);
+    return 0;
+  }
+  return networkfs_fsync(filp, 0, LLONG_MAX, 0);
+}
+
+int networkfs_truncate(struct inode *inode, loff_t size) {
+  truncate_setsize(inode, size);
+  if (NETWORKFS_SB(inode->i_sb)->chunked) {
+    return networkfs_truncate_call(inode, size);
+  }
+  if (size == 0) {
+    return networkfs_save_buffer(inode, "", 0);
+  }
+
+  // Content is uploaded as a whole, make writeback pick the new size up
+  struct page *page = read_mapping_page(inode->i_mapping, 0, NULL);
+  if (IS_ERR(page)) {
+    return PTR_ERR(page);
+  }
+  set_page_dirty_lock(page);
+  put_page(page);
+  // Like the other sizes, the new one reaches the server before returning
+  return filemap_write_and_wait_range(inode->i_mapping, 0, PAGE_SIZE - 1);
+}
+
+struct file_operations networkfs_file_ops = {
+    .open = networkfs_open,
+    .read_iter = generic_file_read_iter,
+    .write_iter = generic_file_write_iter,
+    .mmap = networkfs_mmap,
+    .splice_read = generic_file_splice_read,
+    .flush = networkfs_flush,
+    .fsync = networkfs_fsync,
+    .llseek = generic_file_llseek};
@@ -1,198 +1,1067 @@
 #include "http.h"
 
+#include <linux/ctype.h>
 #include <linux/inet.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <net/sock.h>
+#include <net/tcp_states.h>
 
-const char *HTTP_REQUEST_LINE = "GET /teaching/os/networkfs/v1/";
-const char *HTTP_REQUEST_HEADERS =
-    " HTTP/1.1\r\nHost:nerc.itmo.ru\r\nConnection: close\r\n\r\n";
-const char *SERVER_IP = "77.234.215.132";
-const char *HTTP_LENGTH_HEADER = "Content-Length: ";
-
-// callee should call free_request on received buffer
-int fill_request(struct kvec *vec, const char *token, const char *method,
-                 size_t arg_size, va_list args) {
-  // 2048 bytes for URL and 64 bytes for anything else
-  char *request_buffer = kzalloc(2048 + 64, GFP_KERNEL);
-  if (request_buffer == 0) {
-    return -ENOMEM;
+#include "trace.h"
+
+const char *HTTP_REQUEST_PATH = "/teaching/os/networkfs/v1/";
+const char *HTTP_REQUEST_HOST = " HTTP/1.1\r\nHost: ";
+const char *HTTP_REQUEST_HEADERS = "\r\nConnection: keep-alive\r\n";
+const char *HTTP_FORM_HEADERS =
+    "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: ";
+const char *HTTP_RAW_HEADERS =
+    "Content-Type: application/octet-stream\r\nContent-Length: ";
+
+// Longest status, header or chunk size line kept, longer ones are truncated
+#define NETWORKFS_HTTP_LINE_SIZE 128
+// Receive buffer, used for everything but response bodies
+#define NETWORKFS_HTTP_RECV_SIZE 1024
+// Enough for any Content-Length
+#define NETWORKFS_HTTP_NUMBER_SIZE 24
+// Requests of a batch sent before their responses are read. With more, both
+// socket buffers could fill up: the server blocked writing responses nobody
+// reads, and the client blocked sending requests the server does not read.
+#define NETWORKFS_HTTP_WINDOW (16 * 1024)
+
+// Number of kvecs fill_request() takes for @request
+size_t request_kvecs(const struct networkfs_http_request *request) {
+  switch (request->encoding) {
+    case NETWORKFS_HTTP_FORM:
+      return 11 + 4 * request->arg_size;
+    case NETWORKFS_HTTP_RAW:
+      return 12 + 4 * request->arg_size;
+    default:
+      return 9 + 4 * request->arg_size;
   }
+}
+
+void fill_kvec(struct kvec *vec, const char *string) {
+  vec->iov_base = (void *)string;
+  vec->iov_len = strlen(string);
+}
 
-  strcpy(request_buffer, HTTP_REQUEST_LINE);
-  strcat(request_buffer, token);
-  strcat(request_buffer, "/fs/");
-  strcat(request_buffer, method);
+// Fills 4 kvecs per argument: separator, key, "=" and value
+struct kvec *fill_args(struct kvec *vec, const char *first_separator,
+                       const struct networkfs_http_request *request) {
+  for (int i = 0; i < request->arg_size; i++) {
+    fill_kvec(vec++, i == 0 ? first_separator : "&");
+    fill_kvec(vec++, request->args[2 * i]);
+    fill_kvec(vec++, "=");
+    fill_kvec(vec++, request->args[2 * i + 1]);
+  }
+  return vec;
+}
 
-  for (int i = 0; i < arg_size; i++) {
-    strcat(request_buffer, i == 0 ? "?" : "&");
-    strcat(request_buffer, va_arg(args, char *));
-    strcat(request_buffer, "=");
-    strcat(request_buffer, va_arg(args, char *));
+// Points request_kvecs(@request) kvecs at the pieces of the request: constant
+// parts, settings of @client, arguments and body are sent from where they are,
+// without copying. @length has to hold a number and live as long as the kvecs.
+void fill_request(struct kvec *vec, const struct networkfs_http_client *client,
+                  const struct networkfs_http_request *request,
+                  char *length) {
+  bool post = request->encoding != NETWORKFS_HTTP_QUERY;
+  fill_kvec(vec++, post ? "POST " : "GET ");
+  fill_kvec(vec++, HTTP_REQUEST_PATH);
+  fill_kvec(vec++, client->token);
+  fill_kvec(vec++, "/fs/");
+  fill_kvec(vec++, request->method);
+  if (request->encoding != NETWORKFS_HTTP_FORM) {
+    vec = fill_args(vec, "?", request);
+  }
+  fill_kvec(vec++, HTTP_REQUEST_HOST);
+  fill_kvec(vec++, client->options.host != NULL ? client->options.host
+                                                 : NETWORKFS_HTTP_HOST);
+  fill_kvec(vec++, HTTP_REQUEST_HEADERS);
+  if (!post) {
+    fill_kvec(vec, "\r\n");
+    return;
   }
 
-  strcat(request_buffer, HTTP_REQUEST_HEADERS);
+  fill_kvec(vec++, request->encoding == NETWORKFS_HTTP_FORM ? HTTP_FORM_HEADERS
+                                                            : HTTP_RAW_HEADERS);
+  struct kvec *length_vec = vec++;
+  fill_kvec(vec++, "\r\n\r\n");
 
-  memset(vec, 0, sizeof(struct kvec));
-  vec->iov_base = request_buffer;
-  vec->iov_len = strlen(request_buffer);
+  size_t body_size = 0;
+  if (request->encoding == NETWORKFS_HTTP_FORM) {
+    struct kvec *body = vec;
+    struct kvec *end = fill_args(vec, "", request);
+    for (; body != end; body++) {
+      body_size += body->iov_len;
+    }
+  } else {
+    vec->iov_base = (void *)request->body;
+    vec->iov_len = request->body_size;
+    body_size = request->body_size;
+  }
+  sprintf(length, "%zu", body_size);
+  fill_kvec(length_vec, length);
+}
 
+struct networkfs_connection {
+  struct list_head list;
+  struct socket *sock;
+  unsigned long last_used;
+  char buffer[NETWORKFS_HTTP_RECV_SIZE];  // receives responses
+};
+
+// Requests of a single call, which most calls are, fit in one object
+#define NETWORKFS_HTTP_CALL_KVECS (12 + 4 * NETWORKFS_HTTP_MAX_ARGS)
+
+struct networkfs_call_buffer {
+  size_t first_kvec[2];
+  char length[1][NETWORKFS_HTTP_NUMBER_SIZE];
+  struct kvec kvecs[NETWORKFS_HTTP_CALL_KVECS];
+};
+
+struct kmem_cache *networkfs_connection_cachep;
+struct kmem_cache *networkfs_call_cachep;
+
+int networkfs_http_init(void) {
+  networkfs_connection_cachep = KMEM_CACHE(networkfs_connection, 0);
+  networkfs_call_cachep = KMEM_CACHE(networkfs_call_buffer, 0);
+  if (networkfs_connection_cachep == NULL || networkfs_call_cachep == NULL) {
+    networkfs_http_exit();
+    return -ENOMEM;
+  }
   return 0;
 }
 
-int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
-  struct msghdr hdr;
-  struct kvec vec;
+void networkfs_http_exit(void) {
+  kmem_cache_destroy(networkfs_connection_cachep);
+  kmem_cache_destroy(networkfs_call_cachep);
+}
 
-  int read = 0;
+// Socket timeouts are in jiffies, with no limit set by the maximum
+long networkfs_sock_timeout(unsigned long timeout) {
+  return timeout == 0 ? MAX_SCHEDULE_TIMEOUT : timeout;
+}
 
-  while (read < buffer_size) {
-    memset(&hdr, 0, sizeof(struct msghdr));
-    memset(&vec, 0, sizeof(struct kvec));
-    vec.iov_base = buffer + read;
-    vec.iov_len = buffer_size - read;
-    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, vec.iov_len, 0);
-    if (ret == 0) {
-      break;
-    } else if (ret < 0) {
-      return ESOCKNOMSGRECV;
-    }
-    read += ret;
+// Tells timeouts and signals apart from other socket errors, which are
+// replaced by @fallback
+int networkfs_sock_error(int error, int fallback) {
+  if (error == -EAGAIN) {
+    return -ETIMEDOUT;
   }
+  if (error == -ERESTARTSYS || error == -EINTR) {
+    return -EINTR;
+  }
+  return fallback;
+}
 
-  return read;
+struct networkfs_connection *networkfs_connection_open(
+    const struct networkfs_http_options *options) {
+  struct networkfs_connection *conn =
+      kmem_cache_alloc(networkfs_connection_cachep, GFP_KERNEL);
+  if (conn == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  int error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP,
+                               &conn->sock);
+  if (error < 0) {
+    kmem_cache_free(networkfs_connection_cachep, conn);
+    return ERR_PTR(-ESOCKNOCREATE);
+  }
+
+  struct sockaddr_in s_addr = {.sin_family = AF_INET,
+                               .sin_addr = {.s_addr = options->addr},
+                               .sin_port = htons(options->port)};
+
+  // Blocking connect waits for at most the send timeout
+  struct sock *sk = conn->sock->sk;
+  sk->sk_sndtimeo = networkfs_sock_timeout(options->connect_timeout);
+  error = kernel_connect(conn->sock, (struct sockaddr *)&s_addr,
+                         sizeof(struct sockaddr_in), 0);
+  if (error != 0) {
+    sock_release(conn->sock);
+    kmem_cache_free(networkfs_connection_cachep, conn);
+    // Unfinished connect means it has timed out
+    return ERR_PTR(error == -EINPROGRESS ? -ETIMEDOUT
+                                         : networkfs_sock_error(error, error));
+  }
+  sk->sk_sndtimeo = networkfs_sock_timeout(options->io_timeout);
+  sk->sk_rcvtimeo = networkfs_sock_timeout(options->io_timeout);
+
+  return conn;
 }
 
-int64_t parse_http_response(char *raw_response, size_t raw_response_size,
-                            char *response, size_t response_size) {
-  char *buffer = raw_response;
+void networkfs_connection_close(struct networkfs_connection *conn) {
+  kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+  sock_release(conn->sock);
+  kmem_cache_free(networkfs_connection_cachep, conn);
+}
 
-  // Read Response Line
-  {
-    char *status_line = strsep(&buffer, "\r");
-    strsep(&status_line, " ");
-    if (status_line == 0) {
-      return -EHTTPMALFORMED;
+// Pooled connection may only be reused if the server has not closed it and
+// there is no unexpected data left in it.
+bool networkfs_connection_alive(struct networkfs_http_client *client,
+                                struct networkfs_connection *conn) {
+  struct sock *sk = conn->sock->sk;
+  return time_before(jiffies, conn->last_used + client->idle_timeout) &&
+         sk->sk_state == TCP_ESTABLISHED &&
+         !(sk->sk_shutdown & RCV_SHUTDOWN) &&
+         skb_queue_empty_lockless(&sk->sk_receive_queue);
+}
+
+// Returns an idle connection from the pool, or a new one if there is none,
+// waiting while max_conns connections are in use. @reused is set if the
+// connection has already served some requests.
+struct networkfs_connection *networkfs_pool_get(
+    struct networkfs_http_client *client, bool *reused) {
+  if (down_killable(&client->slots) != 0) {
+    return ERR_PTR(-EINTR);
+  }
+
+  spin_lock(&client->lock);
+  while (!list_empty(&client->idle)) {
+    struct networkfs_connection *conn =
+        list_first_entry(&client->idle, struct networkfs_connection, list);
+    list_del(&conn->list);
+    client->idle_count--;
+    spin_unlock(&client->lock);
+
+    if (networkfs_connection_alive(client, conn)) {
+      atomic64_inc(&client->stats.reused);
+      *reused = true;
+      return conn;
     }
-    char *status_code = strsep(&status_line, " ");
-    if (strcmp(status_code, "200") != 0) {
-      return -EHTTPBADCODE;
+    networkfs_connection_close(conn);
+
+    spin_lock(&client->lock);
+  }
+  spin_unlock(&client->lock);
+
+  *reused = false;
+  struct networkfs_connection *conn =
+      networkfs_connection_open(&client->options);
+  if (IS_ERR(conn)) {
+    up(&client->slots);
+  } else {
+    atomic64_inc(&client->stats.connects);
+  }
+  return conn;
+}
+
+void networkfs_pool_put(struct networkfs_http_client *client,
+                        struct networkfs_connection *conn, bool keep_alive) {
+  if (keep_alive) {
+    conn->last_used = jiffies;
+    spin_lock(&client->lock);
+    if (client->idle_count < client->options.max_conns) {
+      list_add(&conn->list, &client->idle);
+      client->idle_count++;
+      conn = NULL;
     }
+    spin_unlock(&client->lock);
   }
 
-  int length = -1;
+  if (conn != NULL) {
+    networkfs_connection_close(conn);
+  }
+  up(&client->slots);
+}
 
-  while (true) {
-    if (buffer == 0) {
+void networkfs_http_options_init(struct networkfs_http_options *options) {
+  options->addr = in_aton(NETWORKFS_HTTP_SERVER);
+  options->port = NETWORKFS_HTTP_PORT;
+  options->host = NULL;
+  options->connect_timeout = NETWORKFS_CONNECT_TIMEOUT * HZ;
+  options->io_timeout = NETWORKFS_IO_TIMEOUT * HZ;
+  options->max_conns = NETWORKFS_POOL_SIZE;
+  options->retries = NETWORKFS_HTTP_RETRIES;
+  options->workers = NETWORKFS_HTTP_WORKERS;
+}
+
+void networkfs_http_options_free(struct networkfs_http_options *options) {
+  kfree(options->host);
+  options->host = NULL;
+}
+
+// Makes submitted batches until none is left
+struct networkfs_http_worker {
+  struct work_struct work;
+  struct networkfs_http_client *client;
+  struct list_head free;  // entry in @free_workers of the client
+};
+
+void networkfs_http_work(struct work_struct *work);
+
+int networkfs_http_client_init(struct networkfs_http_client *client,
+                               const char *token,
+                               const struct networkfs_http_options *options) {
+  spin_lock_init(&client->lock);
+  INIT_LIST_HEAD(&client->idle);
+  client->idle_count = 0;
+  client->idle_timeout = NETWORKFS_POOL_IDLE_TIMEOUT;
+  memset(&client->stats, 0, sizeof(struct networkfs_http_stats));
+  INIT_LIST_HEAD(&client->free_workers);
+  INIT_LIST_HEAD(&client->pending);
+  client->options = *options;
+  sema_init(&client->slots, options->max_conns);
+  client->options.host = NULL;
+  if (options->host != NULL) {
+    client->options.host = kstrdup(options->host, GFP_KERNEL);
+  }
+  client->token = kstrdup(token, GFP_KERNEL);
+  client->workers = kcalloc(options->workers,
+                            sizeof(struct networkfs_http_worker), GFP_KERNEL);
+  // Writeback may wait for the workers
+  client->wq = alloc_workqueue("networkfs-http", WQ_UNBOUND | WQ_MEM_RECLAIM,
+                               options->workers);
+  if (client->token == NULL ||
+      (options->host != NULL && client->options.host == NULL) ||
+      client->workers == NULL || client->wq == NULL) {
+    return -ENOMEM;
+  }
+  for (unsigned int i = 0; i < options->workers; i++) {
+    INIT_WORK(&client->workers[i].work, networkfs_http_work);
+    client->workers[i].client = client;
+    list_add_tail(&client->workers[i].free, &client->free_workers);
+  }
+  return 0;
+}
+
+void networkfs_http_client_destroy(struct networkfs_http_client *client) {
+  if (client->wq != NULL) {
+    destroy_workqueue(client->wq);
+    client->wq = NULL;
+  }
+  kfree(client->workers);
+  client->workers = NULL;
+
+  struct networkfs_connection *conn, *next;
+  list_for_each_entry_safe(conn, next, &client->idle, list) {
+    list_del(&conn->list);
+    networkfs_connection_close(conn);
+  }
+  client->idle_count = 0;
+  kfree(client->token);
+  client->token = NULL;
+  networkfs_http_options_free(&client->options);
+}
+
+enum networkfs_http_state {
+  HTTP_STATUS_LINE,
+  HTTP_HEADER,
+  HTTP_BODY,         // body of Content-Length, @remaining bytes left
+  HTTP_BODY_TO_EOF,  // no length given, body ends with the connection
+  HTTP_CHUNK_SIZE,
+  HTTP_CHUNK_DATA,  // @remaining bytes of the current chunk left
+  HTTP_CHUNK_END,   // empty line after chunk data
+  HTTP_TRAILER,
+  HTTP_DONE
+};
+
+// Incremental parser of a single HTTP response, fed with data as it arrives.
+// Body is copied straight into the caller's buffer: its first 8 bytes are the
+// status of the call, the rest is the response.
+struct networkfs_http_parser {
+  enum networkfs_http_state state;
+  char line[NETWORKFS_HTTP_LINE_SIZE];  // current line, truncated if longer
+  size_t line_length;
+  bool received;  // set once any byte of the response is received
+  int status_code;
+  bool keep_alive;
+  bool chunked;
+  bool has_length;
+  u64 remaining;
+  int64_t status;
+  size_t body_length;
+  char *response;
+  size_t response_size;
+  int error;
+};
+
+void networkfs_parser_init(struct networkfs_http_parser *parser,
+                           char *response, size_t response_size) {
+  memset(parser, 0, sizeof(struct networkfs_http_parser));
+  parser->state = HTTP_STATUS_LINE;
+  parser->response = response;
+  parser->response_size = response_size;
+}
+
+bool networkfs_parser_in_body(const struct networkfs_http_parser *parser) {
+  return parser->state == HTTP_BODY || parser->state == HTTP_BODY_TO_EOF ||
+         parser->state == HTTP_CHUNK_DATA;
+}
+
+// Returns value of the header @name if @line is that header, NULL otherwise
+const char *networkfs_header_value(const char *line, const char *name) {
+  size_t length = strlen(name);
+  if (strncasecmp(line, name, length) != 0 || line[length] != ':') {
+    return NULL;
+  }
+  return skip_spaces(line + length + 1);
+}
+
+int networkfs_parser_headers_done(struct networkfs_http_parser *parser) {
+  if (parser->chunked) {
+    parser->state = HTTP_CHUNK_SIZE;
+  } else if (parser->has_length) {
+    parser->state = parser->remaining == 0 ? HTTP_DONE : HTTP_BODY;
+  } else {
+    parser->state = HTTP_BODY_TO_EOF;
+    parser->keep_alive = false;
+  }
+  return 0;
+}
+
+int networkfs_parser_chunk_size(struct networkfs_http_parser *parser) {
+  u64 size = 0;
+  const char *c = parser->line;
+  if (hex_to_bin(*c) < 0) {
+    return -EHTTPMALFORMED;
+  }
+  // Chunk extensions after the size are ignored
+  for (int digit; (digit = hex_to_bin(*c)) >= 0; c++) {
+    if (size > (U64_MAX >> 4)) {
       return -EHTTPMALFORMED;
     }
-    char *header = strsep(&buffer, "\r");
-    ++header;  // skip \n
-    if (strcmp(header, "") == 0) {
-      // end of headers
-      break;
-    }
+    size = size * 16 + digit;
+  }
+  parser->remaining = size;
+  parser->state = size == 0 ? HTTP_TRAILER : HTTP_CHUNK_DATA;
+  return 0;
+}
+
+// Handles a complete line, without its CRLF
+int networkfs_parser_line(struct networkfs_http_parser *parser) {
+  const char *line = parser->line;
+  const char *value;
+  unsigned minor;
 
-    if (strncmp(header, HTTP_LENGTH_HEADER, strlen(HTTP_LENGTH_HEADER)) == 0) {
-      int error = kstrtoint(header + strlen(HTTP_LENGTH_HEADER), 0, &length);
-      if (error != 0) {
+  switch (parser->state) {
+    case HTTP_STATUS_LINE:
+      if (sscanf(line, "HTTP/1.%u %d", &minor, &parser->status_code) != 2) {
         return -EHTTPMALFORMED;
       }
-    }
+      parser->keep_alive = minor >= 1;  // HTTP/1.0 closes by default
+      parser->state = HTTP_HEADER;
+      return 0;
+    case HTTP_HEADER:
+      if (*line == '\0') {
+        return networkfs_parser_headers_done(parser);
+      }
+      if ((value = networkfs_header_value(line, "Content-Length")) != NULL) {
+        parser->has_length = true;
+        return kstrtou64(value, 10, &parser->remaining) == 0 ? 0
+                                                             : -EHTTPMALFORMED;
+      }
+      if ((value = networkfs_header_value(line, "Transfer-Encoding")) !=
+          NULL) {
+        parser->chunked = strstr(value, "chunked") != NULL;
+      } else if ((value = networkfs_header_value(line, "Connection")) !=
+                 NULL) {
+        if (strcasecmp(value, "close") == 0) {
+          parser->keep_alive = false;
+        } else if (strcasecmp(value, "keep-alive") == 0) {
+          parser->keep_alive = true;
+        }
+      }
+      return 0;
+    case HTTP_CHUNK_SIZE:
+      return networkfs_parser_chunk_size(parser);
+    case HTTP_CHUNK_END:
+      if (*line != '\0') {
+        return -EHTTPMALFORMED;
+      }
+      parser->state = HTTP_CHUNK_SIZE;
+      return 0;
+    case HTTP_TRAILER:
+      if (*line == '\0') {
+        parser->state = HTTP_DONE;
+      }
+      return 0;
+    default:
+      return -EHTTPMALFORMED;
   }
-  ++buffer;  // skip last '\n'
+}
 
-  if (length == -1) {
-    return -EHTTPMALFORMED;
+// Accounts for @length bytes of body which are already stored
+void networkfs_parser_advance(struct networkfs_http_parser *parser,
+                              size_t length) {
+  parser->body_length += length;
+  if (parser->state == HTTP_BODY_TO_EOF) {
+    return;
   }
+  parser->remaining -= length;
+  if (parser->remaining == 0) {
+    parser->state = parser->state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_END;
+  }
+}
 
-  if (buffer + length > raw_response + raw_response_size) {
-    return -EHTTPMALFORMED;
+// Stores body bytes; whatever does not fit into the response is dropped, and
+// reported by networkfs_parser_result()
+void networkfs_parser_body(struct networkfs_http_parser *parser,
+                           const char *data, size_t length) {
+  size_t offset = parser->body_length;
+  size_t status_part = 0;
+  if (offset < sizeof(int64_t)) {
+    status_part = min(length, sizeof(int64_t) - offset);
+    memcpy((char *)&parser->status + offset, data, status_part);
   }
+  if (status_part < length) {
+    size_t response_offset = offset + status_part - sizeof(int64_t);
+    if (response_offset < parser->response_size) {
+      memcpy(parser->response + response_offset, data + status_part,
+             min(length - status_part,
+                 parser->response_size - response_offset));
+    }
+  }
+  networkfs_parser_advance(parser, length);
+}
 
-  if (length < sizeof(int64_t)) {
-    return -EPROTMALFORMED;
+// Consumes bytes of @data up to the end of the response. Returns number of
+// bytes consumed, the rest belongs to the next response.
+size_t networkfs_parser_feed(struct networkfs_http_parser *parser,
+                             const char *data, size_t size) {
+  size_t used = 0;
+  if (size > 0) {
+    parser->received = true;
   }
+  while (used < size && parser->state != HTTP_DONE && parser->error == 0) {
+    if (networkfs_parser_in_body(parser)) {
+      size_t length = size - used;
+      if (parser->state != HTTP_BODY_TO_EOF) {
+        length = min_t(u64, length, parser->remaining);
+      }
+      networkfs_parser_body(parser, data + used, length);
+      used += length;
+    } else if (data[used] == '\n') {
+      used++;
+      if (parser->line_length > 0 &&
+          parser->line[parser->line_length - 1] == '\r') {
+        parser->line_length--;
+      }
+      parser->line[parser->line_length] = '\0';
+      parser->line_length = 0;
+      parser->error = networkfs_parser_line(parser);
+    } else {
+      if (parser->line_length < NETWORKFS_HTTP_LINE_SIZE - 1) {
+        parser->line[parser->line_length++] = data[used];
+      }
+      used++;
+    }
+  }
+  return used;
+}
 
-  length -= sizeof(int64_t);
+// Finds the part of the caller's buffer the next body bytes may be received
+// into directly, bypassing the receive buffer. Returns its size, zero if
+// there is none.
+size_t networkfs_parser_direct(const struct networkfs_http_parser *parser,
+                               char **destination) {
+  if (!networkfs_parser_in_body(parser) ||
+      parser->body_length < sizeof(int64_t)) {
+    return 0;
+  }
+  size_t offset = parser->body_length - sizeof(int64_t);
+  if (offset >= parser->response_size) {
+    return 0;
+  }
+  size_t length = parser->response_size - offset;
+  if (parser->state != HTTP_BODY_TO_EOF) {
+    length = min_t(u64, length, parser->remaining);
+  }
+  *destination = parser->response + offset;
+  return length;
+}
 
-  if (length > response_size) {
+int64_t networkfs_parser_result(struct networkfs_http_parser *parser) {
+  if (parser->status_code != 200) {
+    return -EHTTPBADCODE;
+  }
+  if (parser->body_length < sizeof(int64_t)) {
+    return -EPROTMALFORMED;
+  }
+  size_t filled = parser->body_length - sizeof(int64_t);
+  if (filled > parser->response_size) {
     return -ENOSPC;
   }
+  // Response buffers come from slab caches unzeroed, so the part a short
+  // response did not fill would otherwise pass stale memory on to the caller
+  if (filled < parser->response_size) {
+    memset(parser->response + filled, 0, parser->response_size - filled);
+  }
+  return parser->status;
+}
 
-  int64_t return_value;
-  memcpy(&return_value, buffer, sizeof(int64_t));
+// Counters of calls are indexed by these names, any other method is counted as
+// "other"
+const char *const networkfs_http_methods[NETWORKFS_METHODS] = {
+    [NETWORKFS_METHOD_LIST] = "list",
+    [NETWORKFS_METHOD_LOOKUP] = "lookup",
+    [NETWORKFS_METHOD_READ] = "read",
+    [NETWORKFS_METHOD_WRITE] = "write",
+    [NETWORKFS_METHOD_CREATE] = "create",
+    [NETWORKFS_METHOD_UNLINK] = "unlink",
+    [NETWORKFS_METHOD_RMDIR] = "rmdir",
+    [NETWORKFS_METHOD_LINK] = "link",
+    [NETWORKFS_METHOD_READ_BLOCK] = "read_block",
+    [NETWORKFS_METHOD_WRITE_BLOCK] = "write_block",
+    [NETWORKFS_METHOD_TRUNCATE] = "truncate",
+    [NETWORKFS_METHOD_LIST_PAGE] = "list_page",
+    [NETWORKFS_METHOD_OTHER] = "other"};
 
-  buffer += sizeof(int64_t);
-  memcpy(response, buffer, length);
+const char *const networkfs_http_errors[NETWORKFS_ERRORS] = {
+    [NETWORKFS_ERROR_TIMEOUT] = "timeout",
+    [NETWORKFS_ERROR_INTERRUPTED] = "interrupted",
+    [NETWORKFS_ERROR_CONNECT] = "connect",
+    [NETWORKFS_ERROR_SOCKET] = "socket",
+    [NETWORKFS_ERROR_HTTP] = "http",
+    [NETWORKFS_ERROR_STATUS] = "status",
+    [NETWORKFS_ERROR_OTHER] = "other"};
 
-  return return_value;
+enum networkfs_http_method networkfs_http_method_index(const char *method) {
+  for (int i = 0; i < NETWORKFS_METHOD_OTHER; i++) {
+    if (strcmp(method, networkfs_http_methods[i]) == 0) {
+      return i;
+    }
+  }
+  return NETWORKFS_METHOD_OTHER;
 }
 
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...) {
-  struct socket *sock;
-  int64_t error;
+u64 networkfs_http_request_ino(const struct networkfs_http_request *request) {
+  u64 ino = 0;
+  for (size_t i = 0; i < request->arg_size; i++) {
+    const char *key = request->args[2 * i];
+    if (strcmp(key, "inode") == 0 ||
+        (ino == 0 && strcmp(key, "parent") == 0)) {
+      if (kstrtou64(request->args[2 * i + 1], 10, &ino) != 0) {
+        ino = 0;
+      }
+    }
+  }
+  return ino;
+}
 
-  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
-  if (error < 0) {
-    return -ESOCKNOCREATE;
+// Accounts a call once its result is known, @answered if it got a response
+void networkfs_http_done(struct networkfs_http_client *client,
+                         const struct networkfs_http_request *request,
+                         ktime_t began, bool answered) {
+  struct networkfs_http_stats *stats = &client->stats;
+  enum networkfs_http_method method =
+      networkfs_http_method_index(request->method);
+  trace_networkfs_http_call(request, began);
+  atomic64_inc(&stats->calls[method]);
+  if (answered) {
+    s64 us = ktime_us_delta(ktime_get(), began);
+    int bucket =
+        us <= 0 ? 0 : min(ilog2(us) + 1, NETWORKFS_LATENCY_BUCKETS - 1);
+    atomic64_inc(&stats->latency[method][bucket]);
   }
 
-  struct sockaddr_in s_addr = {.sin_family = AF_INET,
-                               .sin_addr = {.s_addr = in_aton(SERVER_IP)},
-                               .sin_port = htons(80)};
+  int64_t result = request->result;
+  if (result == 0) {
+    return;
+  }
 
-  error = kernel_connect(sock, (struct sockaddr *)&s_addr,
-                         sizeof(struct sockaddr_in), 0);
-  if (error != 0) {
-    sock_release(sock);
-    return -ESOCKNOCONNECT;
+  enum networkfs_http_error error;
+  if (result > 0) {
+    error = NETWORKFS_ERROR_STATUS;
+    atomic64_inc(&stats->statuses[min_t(int64_t, result,
+                                        NETWORKFS_MAX_STATUS)]);
+  } else if (result == -ETIMEDOUT) {
+    error = NETWORKFS_ERROR_TIMEOUT;
+  } else if (result == -EINTR) {
+    error = NETWORKFS_ERROR_INTERRUPTED;
+  } else if (result == -ESOCKNOCONNECT || result == -ECONNREFUSED ||
+             result == -ECONNRESET || result == -EHOSTUNREACH ||
+             result == -ENETUNREACH) {
+    error = NETWORKFS_ERROR_CONNECT;
+  } else if (result <= -ESOCKNOCREATE && result >= -ESOCKNOMSGRECV) {
+    error = NETWORKFS_ERROR_SOCKET;
+  } else if (result <= -EHTTPBADCODE || result == -ENOSPC) {
+    error = NETWORKFS_ERROR_HTTP;
+  } else {
+    error = NETWORKFS_ERROR_OTHER;
   }
+  atomic64_inc(&stats->errors[error]);
+}
 
-  struct kvec kvec;
-  va_list args;
-  va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
-  va_end(args);
+// Sends @count requests back-to-back over one connection and parses their
+// responses in order as they arrive. Returns number of requests answered; if
+// it is less than @count, *@error tells why the rest was not.
+size_t networkfs_pipeline(struct networkfs_http_client *client,
+                          struct kvec *kvecs, size_t kvec_count,
+                          struct networkfs_http_request *requests,
+                          size_t count, ktime_t began, int *error) {
+  bool reused;
+  struct networkfs_connection *conn = networkfs_pool_get(client, &reused);
+  if (IS_ERR(conn)) {
+    *error = PTR_ERR(conn);
+    return 0;
+  }
+  char *buffer = conn->buffer;
 
-  if (error != 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return error;
+  size_t total_length = 0;
+  for (size_t i = 0; i < kvec_count; i++) {
+    total_length += kvecs[i].iov_len;
   }
 
   struct msghdr msg;
   memset(&msg, 0, sizeof(struct msghdr));
+  msg.msg_flags = MSG_NOSIGNAL;  // reused connection may be closed already
 
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+  bool keep_alive = false;
+  size_t answered = 0;
+  *error = 0;
+  int sent = kernel_sendmsg(conn->sock, &msg, kvecs, kvec_count, total_length);
+  if (sent >= 0 && (size_t)sent < total_length) {
+    // Partial send is cut short by the timeout or a signal
+    *error = signal_pending(current) ? -EINTR : -ETIMEDOUT;
+  } else if (sent < 0) {
+    *error = networkfs_sock_error(sent, reused ? 0 : -ESOCKNOMSGSEND);
+  } else {
+    atomic64_add(sent, &client->stats.bytes_sent);
+    struct networkfs_http_parser parser;
+    networkfs_parser_init(&parser, requests[0].response_buffer,
+                          requests[0].buffer_size);
+    size_t start = 0, end = 0;  // received bytes not parsed yet
+    while (answered < count) {
+      if (start == end) {
+        char *destination;
+        size_t length = networkfs_parser_direct(&parser, &destination);
+        bool direct = length > 0;
+        if (!direct) {
+          destination = buffer;
+          length = NETWORKFS_HTTP_RECV_SIZE;
+        }
+        struct kvec vec = {.iov_base = destination, .iov_len = length};
+        memset(&msg, 0, sizeof(struct msghdr));
+        int ret = kernel_recvmsg(conn->sock, &msg, &vec, 1, length, 0);
+        if (ret == 0 && parser.state == HTTP_BODY_TO_EOF) {
+          parser.state = HTTP_DONE;
+        } else if (ret <= 0) {
+          // Server may close the connection between responses, then the
+          // rest is resent
+          if (ret < 0) {
+            *error = networkfs_sock_error(ret, -ESOCKNOMSGRECV);
+          } else {
+            *error = !parser.received && (reused || answered > 0)
+                         ? 0
+                         : -ESOCKNOMSGRECV;
+          }
+          keep_alive = false;
+          break;
+        } else {
+          atomic64_add(ret, &client->stats.bytes_received);
+          if (direct) {
+            networkfs_parser_advance(&parser, ret);
+          } else {
+            start = 0;
+            end = ret;
+          }
+        }
+      }
 
-  if (error < 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ESOCKNOMSGSEND;
+      start += networkfs_parser_feed(&parser, buffer + start, end - start);
+      if (parser.error != 0) {
+        *error = parser.error;
+        keep_alive = false;
+        break;
+      }
+      if (parser.state == HTTP_DONE) {
+        requests[answered].result = networkfs_parser_result(&parser);
+        networkfs_http_done(client, &requests[answered], began, true);
+        answered++;
+        keep_alive = parser.keep_alive;
+        if (!keep_alive) {
+          break;
+        }
+        if (answered < count) {
+          networkfs_parser_init(&parser, requests[answered].response_buffer,
+                                requests[answered].buffer_size);
+        }
+      }
+    }
+    if (start < end) {
+      keep_alive = false;  // unexpected data, the stream can not be trusted
+    }
   }
 
-  size_t raw_buffer_size = buffer_size + 1024;  // add 1KB for HTTP headers
-  char *raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
-  if (raw_response_buffer == 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ENOMEM;
+  networkfs_pool_put(client, conn, keep_alive && *error == 0);
+  return answered;
+}
+
+// Methods which may be safely repeated when their outcome is unknown
+const char *IDEMPOTENT_METHODS[] = {"list", "lookup", "read", "read_block",
+                                    "list_page"};
+
+bool networkfs_http_idempotent(const struct networkfs_http_request *requests,
+                               size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    bool found = false;
+    for (size_t j = 0; j < ARRAY_SIZE(IDEMPOTENT_METHODS) && !found; j++) {
+      found = strcmp(requests[i].method, IDEMPOTENT_METHODS[j]) == 0;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Failures of the network rather than of the server or the caller
+bool networkfs_http_transient(int error) {
+  switch (error) {
+    case -ETIMEDOUT:
+    case -ECONNREFUSED:
+    case -ECONNRESET:
+    case -EHOSTUNREACH:
+    case -ENETUNREACH:
+    case -ESOCKNOMSGSEND:
+    case -ESOCKNOMSGRECV:
+      return true;
+    default:
+      return false;
+  }
+}
+
+int networkfs_http_errno(int64_t result) {
+  if (result > 0 || result <= -ESOCKNOCREATE) {
+    return -EIO;
   }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
+  return result;
+}
+
+// Number of requests from the @first one which fit into NETWORKFS_HTTP_WINDOW
+// bytes, at least one
+size_t networkfs_http_window(const struct kvec *kvecs, const size_t *first_kvec,
+                             size_t first, size_t count) {
+  size_t bytes = 0;
+  size_t last = first;
+  for (; last < count; last++) {
+    size_t length = 0;
+    for (size_t i = first_kvec[last]; i < first_kvec[last + 1]; i++) {
+      length += kvecs[i].iov_len;
+    }
+    if (last > first && bytes + length > NETWORKFS_HTTP_WINDOW) {
+      break;
+    }
+    bytes += length;
+  }
+  return last - first;
+}
 
-  kernel_sock_shutdown(sock, SHUT_RDWR);
-  sock_release(sock);
+int networkfs_http_call_batch(struct networkfs_http_client *client,
+                              struct networkfs_http_request *requests,
+                              size_t count) {
+  ktime_t began = ktime_get();
+  size_t answered = 0;
+  int error = -ENOMEM;
 
-  if (read_bytes < 0) {
-    kfree(raw_response_buffer);
-    return -ESOCKNOMSGRECV;
+  // Kvecs of the i-th request start at first_kvec[i]
+  size_t *first_kvec = NULL;
+  struct kvec *kvecs = NULL;
+  char(*lengths)[NETWORKFS_HTTP_NUMBER_SIZE] = NULL;
+  struct networkfs_call_buffer *single = NULL;
+  if (count == 1 && request_kvecs(requests) <= NETWORKFS_HTTP_CALL_KVECS) {
+    single = kmem_cache_alloc(networkfs_call_cachep, GFP_KERNEL);
+    if (single == NULL) {
+      goto out;
+    }
+    first_kvec = single->first_kvec;
+    lengths = single->length;
+    kvecs = single->kvecs;
+    first_kvec[0] = 0;
+    first_kvec[1] = request_kvecs(requests);
+  } else {
+    first_kvec = kmalloc_array(count + 1, sizeof(size_t), GFP_KERNEL);
+    lengths = kmalloc_array(count, NETWORKFS_HTTP_NUMBER_SIZE, GFP_KERNEL);
+    if (first_kvec == NULL || lengths == NULL) {
+      goto out;
+    }
+    first_kvec[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+      first_kvec[i + 1] = first_kvec[i] + request_kvecs(&requests[i]);
+    }
+    kvecs = kvmalloc_array(first_kvec[count], sizeof(struct kvec), GFP_KERNEL);
+    if (kvecs == NULL) {
+      goto out;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    fill_request(&kvecs[first_kvec[i]], client, &requests[i], lengths[i]);
   }
+  error = 0;
+
+  unsigned long backoff = NETWORKFS_HTTP_BACKOFF;
+  for (unsigned int attempt = 0;; attempt++) {
+    // Each round makes progress or fails, unless the server closed an idle
+    // connection; then the rest of the batch is resent over another one.
+    while (answered < count && error == 0) {
+      size_t window =
+          networkfs_http_window(kvecs, first_kvec, answered, count);
+      answered += networkfs_pipeline(
+          client, kvecs + first_kvec[answered],
+          first_kvec[answered + window] - first_kvec[answered],
+          requests + answered, window, began, &error);
+    }
 
-  error = parse_http_response(raw_response_buffer, read_bytes, response_buffer,
-                              buffer_size);
+    // Only calls which can be repeated are retried after network failures,
+    // waiting exponentially longer each time
+    if (error == 0 || attempt == client->options.retries ||
+        !networkfs_http_transient(error) ||
+        !networkfs_http_idempotent(requests + answered, count - answered)) {
+      break;
+    }
+    schedule_timeout_killable(backoff);
+    if (fatal_signal_pending(current)) {
+      error = -EINTR;
+      break;
+    }
+    backoff *= 2;
+    error = 0;
+  }
 
-  kfree(raw_response_buffer);
+out:
+  for (size_t i = answered; i < count; i++) {
+    requests[i].result = error;
+    networkfs_http_done(client, &requests[i], began, false);
+  }
+  if (single != NULL) {
+    kmem_cache_free(networkfs_call_cachep, single);
+  } else {
+    kvfree(kvecs);
+    kfree(first_kvec);
+    kfree(lengths);
+  }
   return error;
 }
+
+// Takes the batch to make next, the first one of the process whose turn it is
+struct networkfs_http_async *networkfs_http_next(
+    struct networkfs_http_client *client) {
+  struct networkfs_http_async *async = list_first_entry_or_null(
+      &client->pending, struct networkfs_http_async, node);
+  if (async == NULL) {
+    return NULL;
+  }
+  list_del(&async->node);
+  if (!list_empty(&async->later)) {
+    // The next batch of the process waits for another turn at the end
+    struct networkfs_http_async *next =
+        list_first_entry(&async->later, struct networkfs_http_async, node);
+    list_del(&next->node);
+    list_splice_init(&async->later, &next->later);
+    list_add_tail(&next->node, &client->pending);
+  }
+  return async;
+}
+
+void networkfs_http_work(struct work_struct *work) {
+  struct networkfs_http_worker *worker =
+      container_of(work, struct networkfs_http_worker, work);
+  struct networkfs_http_client *client = worker->client;
+  while (true) {
+    spin_lock(&client->lock);
+    struct networkfs_http_async *async = networkfs_http_next(client);
+    if (async == NULL) {
+      list_add(&worker->free, &client->free_workers);
+      spin_unlock(&client->lock);
+      return;
+    }
+    spin_unlock(&client->lock);
+
+    async->result =
+        networkfs_http_call_batch(client, async->requests, async->count);
+    if (async->done != NULL) {
+      async->done(async);
+    } else {
+      complete(&async->completion);
+    }
+    cond_resched();
+  }
+}
+
+void networkfs_http_submit(struct networkfs_http_client *client,
+                           struct networkfs_http_async *async) {
+  async->owner = task_tgid_nr(current);
+  INIT_LIST_HEAD(&async->later);
+  init_completion(&async->completion);
+
+  spin_lock(&client->lock);
+  struct networkfs_http_async *first;
+  bool queued = false;
+  list_for_each_entry(first, &client->pending, node) {
+    if (first->owner == async->owner) {
+      list_add_tail(&async->node, &first->later);
+      queued = true;
+      break;
+    }
+  }
+  if (!queued) {
+    list_add_tail(&async->node, &client->pending);
+  }
+  struct networkfs_http_worker *worker = list_first_entry_or_null(
+      &client->free_workers, struct networkfs_http_worker, free);
+  if (worker != NULL) {
+    list_del(&worker->free);
+  }
+  spin_unlock(&client->lock);
+
+  if (worker != NULL) {
+    queue_work(client->wq, &worker->work);
+  }
+}
+
+int networkfs_http_wait(struct networkfs_http_async *async) {
+  wait_for_completion(&async->completion);
+  return async->result;
+}
+
+int64_t networkfs_http_vcall(struct networkfs_http_client *client,
+                             struct networkfs_http_request *request,
+                             va_list va) {
+  const char *args[2 * NETWORKFS_HTTP_MAX_ARGS];
+  if (request->arg_size > NETWORKFS_HTTP_MAX_ARGS) {
+    return -EINVAL;
+  }
+  for (size_t i = 0; i < 2 * request->arg_size; i++) {
+    args[i] = va_arg(va, const char *);
+  }
+  request->args = args;
+  networkfs_http_call_batch(client, request, 1);
+  return request->result;
+}
+
+int64_t networkfs_http_call(struct networkfs_http_client *client,
+                            const char *method, char *response_buffer,
+                            size_t buffer_size, size_t arg_size, ...) {
+  struct networkfs_http_request request = {.method = method,
+                                           .response_buffer = response_buffer,
+                                           .buffer_size = buffer_size,
+                                           .arg_size = arg_size};
+  va_list va;
+  va_start(va, arg_size);
+  int64_t result = networkfs_http_vcall(client, &request, va);
+  va_end(va);
+  return result;
+}
+
+int64_t networkfs_http_post(struct networkfs_http_client *client,
+                            const char *method, char *response_buffer,
+                            size_t buffer_size, const char *body,
+                            size_t body_size, size_t arg_size, ...) {
+  struct networkfs_http_request request = {
+      .method = method,
+      .response_buffer = response_buffer,
+      .buffer_size = buffer_size,
+      .arg_size = arg_size,
+      .encoding = body == NULL ? NETWORKFS_HTTP_FORM : NETWORKFS_HTTP_RAW,
+      .body = body,
+      .body_size = body_size};
+  va_list va;
+  va_start(va, arg_size);
+  int64_t result = networkfs_http_vcall(client, &request, va);
+  va_end(va);
+  return result;
+}
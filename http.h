@@ -1,7 +1,13 @@
 #ifndef NETWORKFS_HTTP
 #define NETWORKFS_HTTP
 
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/list.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #define ESOCKNOCREATE 0x2001
 #define ESOCKNOCONNECT 0x2002
@@ -11,26 +17,383 @@
 #define EHTTPMALFORMED 0x2006
 #define EPROTMALFORMED 0x2007
 
+#define NETWORKFS_HTTP_MAX_ARGS 8
+
+// Defaults of struct networkfs_http_options
+#define NETWORKFS_HTTP_SERVER "77.234.215.132"
+#define NETWORKFS_HTTP_PORT 80
+#define NETWORKFS_HTTP_HOST "nerc.itmo.ru"
+#define NETWORKFS_CONNECT_TIMEOUT 10  // in seconds
+#define NETWORKFS_IO_TIMEOUT 30       // in seconds
+#define NETWORKFS_POOL_SIZE 4
+#define NETWORKFS_HTTP_RETRIES 3
+#define NETWORKFS_HTTP_WORKERS 4
+
+// First delay before a retry, doubled by each next one
+#define NETWORKFS_HTTP_BACKOFF (HZ / 10)
+
+#define NETWORKFS_POOL_IDLE_TIMEOUT (15 * HZ)
+
+/**
+ * struct networkfs_http_options - where and how the API server is reached.
+ * @addr:            IPv4 address of the server.
+ * @port:            TCP port of the server.
+ * @host:            Host header of requests, %NETWORKFS_HTTP_HOST if NULL.
+ *                   Owned by the options.
+ * @connect_timeout: Limit of connection establishment in jiffies, 0 for none.
+ * @io_timeout:      Limit of every send and receive in jiffies, 0 for none.
+ * @max_conns:       Number of connections open at once, calls wait for one to
+ *                   become free.
+ * @retries:         How many times idempotent calls are repeated after
+ *                   network failures.
+ * @workers:         Number of submitted batches made at once, see
+ *                   networkfs_http_submit().
+ */
+struct networkfs_http_options {
+  __be32 addr;
+  u16 port;
+  char *host;
+  unsigned long connect_timeout;
+  unsigned long io_timeout;
+  unsigned int max_conns;
+  unsigned int retries;
+  unsigned int workers;
+};
+
+/**
+ * networkfs_http_init - create slab caches of the client, on module load.
+ *
+ * Return: 0 on success, -ENOMEM otherwise.
+ */
+int networkfs_http_init(void);
+
+/**
+ * networkfs_http_exit - destroy slab caches of the client, on module unload.
+ */
+void networkfs_http_exit(void);
+
+/**
+ * networkfs_http_options_init - fill @options with defaults.
+ */
+void networkfs_http_options_init(struct networkfs_http_options *options);
+
+/**
+ * networkfs_http_options_free - free memory owned by @options.
+ */
+void networkfs_http_options_free(struct networkfs_http_options *options);
+
+// Latency histograms have log2 buckets of microseconds, the last one also
+// counts everything slower
+#define NETWORKFS_LATENCY_BUCKETS 24
+// Server statuses are counted up to this one, greater ones are counted with it
+#define NETWORKFS_MAX_STATUS 15
+
+enum networkfs_http_method {
+  NETWORKFS_METHOD_LIST,
+  NETWORKFS_METHOD_LOOKUP,
+  NETWORKFS_METHOD_READ,
+  NETWORKFS_METHOD_WRITE,
+  NETWORKFS_METHOD_CREATE,
+  NETWORKFS_METHOD_UNLINK,
+  NETWORKFS_METHOD_RMDIR,
+  NETWORKFS_METHOD_LINK,
+  NETWORKFS_METHOD_READ_BLOCK,
+  NETWORKFS_METHOD_WRITE_BLOCK,
+  NETWORKFS_METHOD_TRUNCATE,
+  NETWORKFS_METHOD_LIST_PAGE,
+  NETWORKFS_METHOD_OTHER,
+  NETWORKFS_METHODS
+};
+
+extern const char *const networkfs_http_methods[NETWORKFS_METHODS];
+
+enum networkfs_http_error {
+  NETWORKFS_ERROR_TIMEOUT,
+  NETWORKFS_ERROR_INTERRUPTED,
+  NETWORKFS_ERROR_CONNECT,  // server is unreachable or refused connection
+  NETWORKFS_ERROR_SOCKET,
+  NETWORKFS_ERROR_HTTP,  // malformed or unexpected response
+  NETWORKFS_ERROR_STATUS,  // server returned non-zero status
+  NETWORKFS_ERROR_OTHER,
+  NETWORKFS_ERRORS
+};
+
+extern const char *const networkfs_http_errors[NETWORKFS_ERRORS];
+
+/**
+ * struct networkfs_http_stats - counters of a client, updated without locks.
+ * @calls:          Calls made, by &enum networkfs_http_method.
+ * @latency:        Histograms of latency of answered calls, by method. Time
+ *                  is counted from the start of the batch, retries included.
+ * @errors:         Failed calls, by &enum networkfs_http_error.
+ * @statuses:       Calls failed with %NETWORKFS_ERROR_STATUS, by status.
+ * @bytes_sent:     Bytes of requests sent.
+ * @bytes_received: Bytes of responses received, headers included.
+ * @connects:       Connections opened.
+ * @reused:         Connections taken from the pool.
+ */
+struct networkfs_http_stats {
+  atomic64_t calls[NETWORKFS_METHODS];
+  atomic64_t latency[NETWORKFS_METHODS][NETWORKFS_LATENCY_BUCKETS];
+  atomic64_t errors[NETWORKFS_ERRORS];
+  atomic64_t statuses[NETWORKFS_MAX_STATUS + 1];
+  atomic64_t bytes_sent;
+  atomic64_t bytes_received;
+  atomic64_t connects;
+  atomic64_t reused;
+};
+
+/**
+ * struct networkfs_http_client - per-filesystem state of the API client.
+ * @token:        Unique filesystem token.
+ * @options:      Server and connection settings, see networkfs_http_options.
+ * @slots:        Counts down connections which may still be opened or taken
+ *                from @idle, up to @options.max_conns.
+ * @lock:         Protects @idle, @idle_count, @pending and @free_workers.
+ * @idle:         Keep-alive connections ready for reuse, most recent first.
+ * @idle_count:   Number of connections in @idle.
+ * @idle_timeout: Connections unused for longer than this (in jiffies) are
+ *                closed instead of being reused.
+ * @stats:        Counters of calls and connections.
+ * @wq:           Workqueue @workers run on.
+ * @workers:      Array of @options.workers workers making submitted batches.
+ * @free_workers: Workers which are not queued on @wq.
+ * @pending:      Submitted batches which are not started yet, the first one
+ *                of every process in round-robin order.
+ */
+struct networkfs_http_client {
+  char *token;
+  struct networkfs_http_options options;
+  struct semaphore slots;
+  spinlock_t lock;
+  struct list_head idle;
+  size_t idle_count;
+  unsigned long idle_timeout;
+  struct networkfs_http_stats stats;
+  struct workqueue_struct *wq;
+  struct networkfs_http_worker *workers;
+  struct list_head free_workers;
+  struct list_head pending;
+};
+
+/**
+ * networkfs_http_client_init - prepare @client for use.
+ * @client:  Client to initialize.
+ * @token:   Unique filesystem token, copied into @client.
+ * @options: Settings copied into @client.
+ *
+ * Return: 0 on success, -ENOMEM if @token or @options can not be copied or
+ * workers can not be created. In both cases @client has to be destroyed with
+ * networkfs_http_client_destroy().
+ */
+int networkfs_http_client_init(struct networkfs_http_client *client,
+                               const char *token,
+                               const struct networkfs_http_options *options);
+
+/**
+ * networkfs_http_client_destroy - close pooled connections and free @client
+ * resources. No calls may be in flight, submitted batches are waited for.
+ */
+void networkfs_http_client_destroy(struct networkfs_http_client *client);
+
+/**
+ * enum networkfs_http_encoding - how a call is sent.
+ * @NETWORKFS_HTTP_QUERY: GET with arguments in the URL.
+ * @NETWORKFS_HTTP_FORM:  POST with arguments in an
+ *                        application/x-www-form-urlencoded body.
+ * @NETWORKFS_HTTP_RAW:   POST with arguments in the URL and an
+ *                        application/octet-stream body.
+ */
+enum networkfs_http_encoding {
+  NETWORKFS_HTTP_QUERY,
+  NETWORKFS_HTTP_FORM,
+  NETWORKFS_HTTP_RAW
+};
+
+/**
+ * struct networkfs_http_request - a single call in a batch.
+ * @method:          API method name, e.g. "lookup" for fs.lookup.
+ * @response_buffer: Memory space for writing the response.
+ * @buffer_size:     Size of @response_buffer.
+ * @arg_size:        Number of arguments provided.
+ * @args:            Exactly twice of @arg_size strings in format
+ *                   key1, value1, key2, value2, ...
+ * @encoding:        How the call is sent, %NETWORKFS_HTTP_QUERY if zeroed.
+ * @body:            Body sent with %NETWORKFS_HTTP_RAW, not escaped.
+ * @body_size:       Size of @body.
+ * @result:          Filled in by networkfs_http_call_batch(), same as the
+ *                   return value of networkfs_http_call().
+ */
+struct networkfs_http_request {
+  const char *method;
+  char *response_buffer;
+  size_t buffer_size;
+  size_t arg_size;
+  const char **args;
+  enum networkfs_http_encoding encoding;
+  const char *body;
+  size_t body_size;
+  int64_t result;
+};
+
+/**
+ * networkfs_http_call_batch - make several calls to networkfs API at once.
+ * @client:   Client of the filesystem the calls are made for.
+ * @requests: Calls to make, results are written into them.
+ * @count:    Number of @requests.
+ *
+ * Requests are pipelined over a keep-alive connection: they are sent
+ * back-to-back and responses are read in the same order, so a batch costs
+ * about one round trip per 16 KB of requests. At most that much is sent before
+ * the responses are read, so that neither side blocks on a full socket buffer.
+ * If the server closes the connection in the middle, the unanswered requests
+ * are resent over another one.
+ * Responses are parsed as they arrive, delimited by Content-Length or sent
+ * in chunks, and their bodies are copied straight into the response buffers.
+ *
+ * Batches of idempotent calls, such as "list", "lookup" and "read", are
+ * retried with exponential backoff when the network fails, up to
+ * @client->options.retries times.
+ *
+ * Return: 0 if every request got a response, otherwise negated errno of the
+ * failure, which is also stored as ->result of every unanswered request.
+ * Timeouts are reported as -ETIMEDOUT.
+ */
+int networkfs_http_call_batch(struct networkfs_http_client *client,
+                              struct networkfs_http_request *requests,
+                              size_t count);
+
+struct networkfs_http_async;
+
+typedef void (*networkfs_http_done_t)(struct networkfs_http_async *async);
+
+/**
+ * struct networkfs_http_async - a batch of calls made in the background.
+ * @requests:   Calls to make, as for networkfs_http_call_batch().
+ * @count:      Number of @requests.
+ * @done:       Called by the worker once the batch is made, may free the
+ *              structure. NULL to complete @completion instead.
+ * @result:     Return value of networkfs_http_call_batch().
+ * @completion: Completed once the batch is made, unless @done is set.
+ * @owner:      Process the batch was submitted by.
+ * @node:       Entry in @pending of the client, or in @later of the first
+ *              pending batch of @owner.
+ * @later:      Batches of @owner submitted after this one, while it waits.
+ *
+ * Everything past @done is filled in by networkfs_http_submit().
+ */
+struct networkfs_http_async {
+  struct networkfs_http_request *requests;
+  size_t count;
+  networkfs_http_done_t done;
+  int result;
+  struct completion completion;
+  pid_t owner;
+  struct list_head node;
+  struct list_head later;
+};
+
+/**
+ * networkfs_http_submit - make a batch of calls on a worker of @client.
+ * @client: Client of the filesystem the calls are made for.
+ * @async:  The batch, has to stay valid until it is made.
+ *
+ * At most @client->options.workers batches are made at once, each of them
+ * like networkfs_http_call_batch() does, over its own pooled connection.
+ * Batches wait for a worker in queues of the processes which submitted them,
+ * served in turns, so that a process submitting a lot of them does not hold
+ * up the others. Batches of the same process are started in submission order.
+ *
+ * The caller is notified by @async->done, or waits with networkfs_http_wait().
+ */
+void networkfs_http_submit(struct networkfs_http_client *client,
+                           struct networkfs_http_async *async);
+
+/**
+ * networkfs_http_wait - wait until a batch submitted without @done is made.
+ * @async: The batch.
+ *
+ * Waits uninterruptibly, as the batch writes into buffers of the caller.
+ * Calls themselves are limited by timeouts of the client.
+ *
+ * Return: @async->result.
+ */
+int networkfs_http_wait(struct networkfs_http_async *async);
+
 /**
  * networkfs_http_call - make a call to networkfs API.
- * @token:           Unique filesystem token.
+ * @client:          Client of the filesystem the call is made for.
  * @method:          API method name, e.g. "list" for fs.list.
  * @response_buffer: Pointer to memory space for writing the response.
  *                   There should be available at least @buffer_size bytes.
- * @arg_size:        Number of arguments provided.
+ * @arg_size:        Number of arguments provided, at most
+ *                   %NETWORKFS_HTTP_MAX_ARGS.
  * @...:             Exactly twice of @arg_size string arguments in format
  *                   key1, value1, key2, value2, ...
  *
  * This method makes an HTTP call to networkfs API server and parses the result.
+ * The request is sent over a keep-alive connection borrowed from the @client
+ * pool; a pooled connection found closed by the server is replaced by a fresh
+ * one transparently.
  *
  * Return:
  * * If HTTP session succeeds, returns `result->status`.
  *   `result->response` is written into @response_buffer.
  * * Otherwise, returns negated errno, either defined in `errno-base.h`
- *   or in `http.h`, and @response_buffer stays unaltered.
+ *   or in `http.h`, and content of @response_buffer is undefined.
+ */
+int64_t networkfs_http_call(struct networkfs_http_client *client,
+                            const char *method, char *response_buffer,
+                            size_t buffer_size, size_t arg_size, ...);
+
+/**
+ * networkfs_http_post - make a call to networkfs API with a POST body.
+ * @client:          Client of the filesystem the call is made for.
+ * @method:          API method name, e.g. "write" for fs.write.
+ * @response_buffer: Pointer to memory space for writing the response.
+ * @buffer_size:     Size of @response_buffer.
+ * @body:            Raw content sent as application/octet-stream, or NULL to
+ *                   send the arguments as application/x-www-form-urlencoded.
+ * @body_size:       Size of @body.
+ * @arg_size:        Number of arguments provided, at most
+ *                   %NETWORKFS_HTTP_MAX_ARGS.
+ * @...:             Exactly twice of @arg_size string arguments in format
+ *                   key1, value1, key2, value2, ... With @body they are sent
+ *                   in the URL.
+ *
+ * Content sent in @body is neither escaped nor bounded by URL length limits.
+ *
+ * Return: same as networkfs_http_call().
+ */
+int64_t networkfs_http_post(struct networkfs_http_client *client,
+                            const char *method, char *response_buffer,
+                            size_t buffer_size, const char *body,
+                            size_t body_size, size_t arg_size, ...);
+
+/**
+ * networkfs_http_request_ino - inode a call is about, for tracing.
+ * @request: The call.
+ *
+ * Return: value of the "inode" or else "parent" argument, 0 if there is none.
+ */
+u64 networkfs_http_request_ino(const struct networkfs_http_request *request);
+
+/**
+ * networkfs_http_errno - errno to report for a failed call.
+ * @result: Result of the call.
+ *
+ * Return: @result if it is a standard errno, -EIO for statuses returned by the
+ * server and HTTP or protocol errors defined in `http.h`.
+ */
+int networkfs_http_errno(int64_t result);
+
+/**
+ * networkfs_http_transient - whether a call may succeed if it is made again.
+ * @error: Result of the call, possibly converted by networkfs_http_errno().
+ *
+ * Return: true for failures of the network rather than of the server or the
+ * caller, such as timeouts and reset connections.
  */
-int64_t networkfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t arg_size, ...);
+bool networkfs_http_transient(int error);
 
 #endif
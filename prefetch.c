@@ -0,0 +1,193 @@
+#include <linux/pagemap.h>
+
+#include "entrypoint.h"
+
+// Tools like "grep -r" open every file right after listing the directory, so
+// with prefetch= the first page of every small regular file found by readdir
+// is read ahead in the background, and the open is served from page cache if
+// it comes within attr_timeout. Later opens read the file again as usual, so
+// files are dropped from the LRU once that passes, and attr_timeout= also
+// bounds how long prefetched pages are held
+
+// Queued or prefetched file, holds a reference to the inode until it is
+// opened, dropped from the LRU or the filesystem is unmounted
+struct networkfs_prefetch {
+  struct work_struct work;
+  struct list_head lru;  // empty until the file is prefetched
+  struct inode *inode;
+};
+
+// Only the first page is read, see networkfs_fetch_data
+#define NETWORKFS_PREFETCH_PAGES 1
+
+void networkfs_prefetch_free(struct networkfs_prefetch *prefetch) {
+  iput(prefetch->inode);
+  kfree(prefetch);
+}
+
+// Drops pages of the least recently prefetched files until the rest fits
+// NETWORKFS_PREFETCH_MEMORY and has not expired
+void networkfs_prefetch_shrink(struct networkfs_sb_info *info) {
+  LIST_HEAD(victims);
+  spin_lock(&info->prefetch_lock);
+  while (!list_empty(&info->prefetch_lru)) {
+    struct networkfs_prefetch *prefetch = list_first_entry(
+        &info->prefetch_lru, struct networkfs_prefetch, lru);
+    if (info->prefetch_memory <= NETWORKFS_PREFETCH_MEMORY &&
+        networkfs_data_fresh(prefetch->inode)) {
+      break;
+    }
+    list_move_tail(&prefetch->lru, &victims);
+    NETWORKFS_I(prefetch->inode)->prefetch = NULL;
+    info->prefetch_memory -= NETWORKFS_PREFETCH_PAGES * PAGE_SIZE;
+  }
+  // Files left expire within attr_timeout, they are looked at again then
+  if (!list_empty(&info->prefetch_lru) && !info->prefetch_stopping) {
+    queue_delayed_work(system_unbound_wq, &info->prefetch_expire,
+                       info->attr_timeout);
+  }
+  spin_unlock(&info->prefetch_lock);
+
+  struct networkfs_prefetch *prefetch, *next;
+  list_for_each_entry_safe(prefetch, next, &victims, lru) {
+    // Pages which are mapped or dirty stay
+    invalidate_mapping_pages(prefetch->inode->i_mapping, 0, -1);
+    networkfs_prefetch_free(prefetch);
+  }
+}
+
+void networkfs_prefetch_expire(struct work_struct *work) {
+  networkfs_prefetch_shrink(container_of(
+      to_delayed_work(work), struct networkfs_sb_info, prefetch_expire));
+}
+
+void networkfs_prefetch_work(struct work_struct *work) {
+  struct networkfs_prefetch *prefetch =
+      container_of(work, struct networkfs_prefetch, work);
+  struct inode *inode = prefetch->inode;
+  struct networkfs_sb_info *info = NETWORKFS_SB(inode->i_sb);
+
+  int res = 0;
+  if (!READ_ONCE(info->prefetch_stopping) && !networkfs_data_fresh(inode)) {
+    res = networkfs_fetch_data(inode);
+  }
+  // Sizes of new inodes are only known once they are read, larger files are
+  // not kept
+  bool keep = res == 0 && !READ_ONCE(info->prefetch_stopping) &&
+              i_size_read(inode) <= info->prefetch_size;
+
+  spin_lock(&info->prefetch_lock);
+  info->prefetch_queued--;
+  // The file may have been opened in the meantime
+  if (NETWORKFS_I(inode)->prefetch != prefetch) {
+    keep = false;
+  } else if (keep) {
+    list_add_tail(&prefetch->lru, &info->prefetch_lru);
+    info->prefetch_memory += NETWORKFS_PREFETCH_PAGES * PAGE_SIZE;
+  } else {
+    NETWORKFS_I(inode)->prefetch = NULL;
+  }
+  spin_unlock(&info->prefetch_lock);
+
+  if (keep) {
+    networkfs_prefetch_shrink(info);
+  } else {
+    networkfs_prefetch_free(prefetch);
+  }
+}
+
+void networkfs_prefetch(struct inode *inode) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(inode->i_sb);
+  if (info->prefetch_size == 0 || !S_ISREG(inode->i_mode) ||
+      i_size_read(inode) > info->prefetch_size ||
+      networkfs_data_fresh(inode) || READ_ONCE(NETWORKFS_I(inode)->prefetch)) {
+    return;
+  }
+
+  struct networkfs_prefetch *prefetch =
+      kmalloc(sizeof(struct networkfs_prefetch), GFP_KERNEL);
+  if (prefetch == NULL) {
+    return;
+  }
+  INIT_WORK(&prefetch->work, networkfs_prefetch_work);
+  INIT_LIST_HEAD(&prefetch->lru);
+  prefetch->inode = igrab(inode);
+  if (prefetch->inode == NULL) {
+    kfree(prefetch);
+    return;
+  }
+
+  spin_lock(&info->prefetch_lock);
+  // Files found while the queue is full are read on open as usual
+  bool queue = NETWORKFS_I(inode)->prefetch == NULL &&
+               info->prefetch_queued < NETWORKFS_PREFETCH_QUEUE;
+  if (queue) {
+    NETWORKFS_I(inode)->prefetch = prefetch;
+    info->prefetch_queued++;
+  }
+  spin_unlock(&info->prefetch_lock);
+
+  if (queue) {
+    queue_work(info->prefetch_wq, &prefetch->work);
+  } else {
+    networkfs_prefetch_free(prefetch);
+  }
+}
+
+void networkfs_prefetch_forget(struct inode *inode) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(inode->i_sb);
+  if (info->prefetch_size == 0) {
+    return;
+  }
+
+  spin_lock(&info->prefetch_lock);
+  struct networkfs_prefetch *prefetch = NETWORKFS_I(inode)->prefetch;
+  NETWORKFS_I(inode)->prefetch = NULL;
+  if (prefetch != NULL && list_empty(&prefetch->lru)) {
+    // Still queued, the work frees it once it sees the file is forgotten
+    prefetch = NULL;
+  } else if (prefetch != NULL) {
+    list_del(&prefetch->lru);
+    info->prefetch_memory -= NETWORKFS_PREFETCH_PAGES * PAGE_SIZE;
+  }
+  spin_unlock(&info->prefetch_lock);
+
+  if (prefetch != NULL) {
+    networkfs_prefetch_free(prefetch);
+  }
+}
+
+int networkfs_prefetch_start(struct super_block *sb) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(sb);
+  if (info->prefetch_size == 0) {
+    return 0;
+  }
+  INIT_DELAYED_WORK(&info->prefetch_expire, networkfs_prefetch_expire);
+  info->prefetch_wq = alloc_workqueue("networkfs-prefetch", WQ_UNBOUND,
+                                      NETWORKFS_PREFETCH_CONCURRENCY);
+  return info->prefetch_wq == NULL ? -ENOMEM : 0;
+}
+
+// Has to be called before inodes are evicted on unmount, as prefetched files
+// hold references to them
+void networkfs_prefetch_stop(struct super_block *sb) {
+  struct networkfs_sb_info *info = NETWORKFS_SB(sb);
+  if (info->prefetch_wq == NULL) {
+    return;
+  }
+  // Set under the lock, so that nothing queues the expiry once it is cancelled
+  spin_lock(&info->prefetch_lock);
+  WRITE_ONCE(info->prefetch_stopping, true);
+  spin_unlock(&info->prefetch_lock);
+  cancel_delayed_work_sync(&info->prefetch_expire);
+  destroy_workqueue(info->prefetch_wq);
+  info->prefetch_wq = NULL;
+
+  struct networkfs_prefetch *prefetch, *next;
+  list_for_each_entry_safe(prefetch, next, &info->prefetch_lru, lru) {
+    NETWORKFS_I(prefetch->inode)->prefetch = NULL;
+    networkfs_prefetch_free(prefetch);
+  }
+  INIT_LIST_HEAD(&info->prefetch_lru);
+  info->prefetch_memory = 0;
+}
@@ -0,0 +1,93 @@
+#include <linux/debugfs.h>
+
+#include "entrypoint.h"
+
+const char *const networkfs_caches[NETWORKFS_CACHES] = {
+    [NETWORKFS_CACHE_ENTRY] = "entry",
+    [NETWORKFS_CACHE_NEGATIVE] = "negative",
+    [NETWORKFS_CACHE_LISTING] = "listing",
+    [NETWORKFS_CACHE_DATA] = "data"};
+
+struct dentry *networkfs_debugfs_root;
+
+void networkfs_cache_count(struct super_block *sb, enum networkfs_cache cache,
+                           bool hit) {
+  struct networkfs_cache_stats *stats = &NETWORKFS_SB(sb)->cache_stats;
+  atomic64_inc(hit ? &stats->hits[cache] : &stats->misses[cache]);
+}
+
+// One "name value" pair per line; histograms list the upper bound of every
+// non-empty bucket in microseconds, the last bucket has no bound
+int networkfs_stats_show(struct seq_file *m, void *unused) {
+  struct networkfs_sb_info *info = m->private;
+  struct networkfs_http_stats *stats = &info->client.stats;
+
+  seq_printf(m, "bytes_sent %lld\n", atomic64_read(&stats->bytes_sent));
+  seq_printf(m, "bytes_received %lld\n",
+             atomic64_read(&stats->bytes_received));
+  seq_printf(m, "connects %lld\n", atomic64_read(&stats->connects));
+  seq_printf(m, "reused %lld\n", atomic64_read(&stats->reused));
+
+  for (int i = 0; i < NETWORKFS_METHODS; i++) {
+    seq_printf(m, "calls.%s %lld\n", networkfs_http_methods[i],
+               atomic64_read(&stats->calls[i]));
+  }
+  for (int i = 0; i < NETWORKFS_ERRORS; i++) {
+    seq_printf(m, "errors.%s %lld\n", networkfs_http_errors[i],
+               atomic64_read(&stats->errors[i]));
+  }
+  for (int i = 1; i <= NETWORKFS_MAX_STATUS; i++) {
+    s64 count = atomic64_read(&stats->statuses[i]);
+    if (count != 0) {
+      seq_printf(m, "status.%d%s %lld\n", i,
+                 i == NETWORKFS_MAX_STATUS ? "+" : "", count);
+    }
+  }
+
+  for (int i = 0; i < NETWORKFS_CACHES; i++) {
+    seq_printf(m, "cache.%s.hits %lld\n", networkfs_caches[i],
+               atomic64_read(&info->cache_stats.hits[i]));
+    seq_printf(m, "cache.%s.misses %lld\n", networkfs_caches[i],
+               atomic64_read(&info->cache_stats.misses[i]));
+  }
+
+  for (int i = 0; i < NETWORKFS_METHODS; i++) {
+    for (int bucket = 0; bucket < NETWORKFS_LATENCY_BUCKETS; bucket++) {
+      s64 count = atomic64_read(&stats->latency[i][bucket]);
+      if (count == 0) {
+        continue;
+      }
+      if (bucket == NETWORKFS_LATENCY_BUCKETS - 1) {
+        seq_printf(m, "latency_us.%s.inf %lld\n", networkfs_http_methods[i],
+                   count);
+      } else {
+        seq_printf(m, "latency_us.%s.%lu %lld\n", networkfs_http_methods[i],
+                   1UL << bucket, count);
+      }
+    }
+  }
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(networkfs_stats);
+
+void networkfs_debugfs_init(void) {
+  networkfs_debugfs_root = debugfs_create_dir("networkfs", NULL);
+}
+
+void networkfs_debugfs_exit(void) { debugfs_remove(networkfs_debugfs_root); }
+
+// Failures of debugfs are not reported, as elsewhere in the kernel: the
+// filesystem works the same without statistics
+void networkfs_debugfs_add(struct super_block *sb) {
+  char name[32];
+  snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+  struct dentry *dir = debugfs_create_dir(name, networkfs_debugfs_root);
+  debugfs_create_file("stats", 0444, dir, NETWORKFS_SB(sb),
+                      &networkfs_stats_fops);
+  NETWORKFS_SB(sb)->debugfs = dir;
+}
+
+void networkfs_debugfs_remove(struct super_block *sb) {
+  debugfs_remove(NETWORKFS_SB(sb)->debugfs);
+  NETWORKFS_SB(sb)->debugfs = NULL;
+}
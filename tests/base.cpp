@@ -205,3 +205,23 @@ TEST_F(BaseTest, RemoveNonEmptyDirectory) {
   std::set<std::string> actual_files = list_directory({"."});
   ASSERT_EQ(actual_files, expected_files);
 }
+
+TEST_F(BaseTest, ShowOptions) {
+  std::ifstream mounts("/proc/mounts");
+  std::string line;
+  std::string options;
+  while (std::getline(mounts, line)) {
+    if (line.find(" " + TEST_ROOT.string() + " networkfs ") != std::string::npos) {
+      options = line;
+    }
+  }
+
+  if (nfs_endpoint.mount_options.empty()) {
+    ASSERT_NE(options.find("server=77.234.215.132"), std::string::npos);
+    ASSERT_NE(options.find("port=80"), std::string::npos);
+  } else {
+    ASSERT_NE(options.find(nfs_endpoint.mount_options), std::string::npos);
+  }
+  ASSERT_NE(options.find("attr_timeout=1"), std::string::npos);
+  ASSERT_NE(options.find("workers=4"), std::string::npos);
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "escape.h"
+
+// Previous escape_name(): strlen() on every iteration and sprintf() per
+// character, stops at the first NUL byte
+std::string legacy_escape(const char *name, size_t size) {
+  char *escaped_name = (char *)calloc(size * 3 + 1, 1);
+  int pos = 0;
+  for (int i = 0; i < strlen(name); i++) {
+    if (isalnum(name[i]) || name[i] == '-' || name[i] == '_' ||
+        name[i] == '.' || name[i] == '~') {
+      sprintf((char *)escaped_name + pos, "%c", name[i]);
+      pos++;
+    } else {
+      sprintf((char *)escaped_name + pos, "%%%02X", name[i]);
+      pos += 3;
+    }
+  }
+  std::string result(escaped_name, pos);
+  free(escaped_name);
+  return result;
+}
+
+std::string table_escape(const char *name, size_t size) {
+  std::string result(size * 3, '\0');
+  result.resize(networkfs_escape(result.data(), name, size));
+  return result;
+}
+
+template <typename Escape>
+double throughput(Escape escape, const std::vector<std::string> &inputs,
+                  int iterations) {
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    for (const std::string &input : inputs) {
+      total += escape(input.c_str(), input.size()).size();
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (total == 0) {
+    std::abort();  // keeps the work from being optimized away
+  }
+  return inputs.size() * inputs[0].size() * iterations / elapsed.count() /
+         (1 << 20);
+}
+
+// Usage: networkfs_escape_bench [iterations]
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+  // Printable ASCII without NUL, so that both versions see the same input
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> character(' ', '~');
+  std::vector<std::string> names(64, std::string(255, ' '));
+  std::vector<std::string> contents(64, std::string(512, ' '));
+  for (auto *inputs : {&names, &contents}) {
+    for (std::string &input : *inputs) {
+      for (char &c : input) {
+        c = character(random);
+      }
+      if (legacy_escape(input.c_str(), input.size()) !=
+          table_escape(input.c_str(), input.size())) {
+        fprintf(stderr, "escaped results differ for \"%s\"\n", input.c_str());
+        return 1;
+      }
+    }
+  }
+
+  printf("%-20s %12s %12s\n", "input", "legacy MB/s", "table MB/s");
+  printf("%-20s %12.1f %12.1f\n", "255-byte name",
+         throughput(legacy_escape, names, iterations),
+         throughput(table_escape, names, iterations));
+  printf("%-20s %12.1f %12.1f\n", "512-byte content",
+         throughput(legacy_escape, contents, iterations),
+         throughput(table_escape, contents, iterations));
+  return 0;
+}
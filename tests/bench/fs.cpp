@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "lib/environment.hpp"
+#include "lib/nfs.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+  std::string name;
+  size_t ops;
+  double seconds;
+  double p50_us;
+  double p99_us;
+};
+
+/* Runs @op @iterations times on a freshly mounted bucket prepared by @setup. */
+Result run(const std::string& name, size_t iterations, const std::function<void(NfsBucket&)>& setup,
+           const std::function<void(size_t)>& op) {
+  NfsBucket nfs;
+  nfs.initialize();
+  setup(nfs);
+  fs::path previous_path = fs::current_path();
+  fs::current_path(TEST_ROOT);
+
+  std::vector<double> latencies;
+  latencies.reserve(iterations);
+  auto start = Clock::now();
+  try {
+    for (size_t i = 0; i < iterations; i++) {
+      auto op_start = Clock::now();
+      op(i);
+      latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - op_start).count());
+    }
+  } catch (...) {
+    fs::current_path(previous_path);
+    nfs.unmount(false);
+    throw;
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  fs::current_path(previous_path);
+  nfs.unmount(true);
+
+  std::sort(latencies.begin(), latencies.end());
+  return {name, iterations, seconds, latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]};
+}
+
+void check(bool ok, const std::string& what) {
+  if (!ok) {
+    throw std::runtime_error(what + " failed: " + strerror(errno));
+  }
+}
+
+void create_file(const char* name) {
+  int fd = open(name, O_CREAT | O_WRONLY, 0644);
+  check(fd >= 0, "create");
+  check(close(fd) == 0, "close");
+}
+
+/*
+ * Usage: networkfs_bench [--iterations N] [--latency-us N] [--bandwidth N]
+ *                        [--options chunked,post,...] [--output FILE]
+ *
+ * Mounts the filesystem against a local server with the given latency and
+ * bandwidth, and writes ops/s and p50/p99 latency of every scenario as JSON.
+ * Has to be run as root from the build directory, like the tests.
+ */
+int main(int argc, char **argv) {
+  size_t iterations = 1000;
+  NfsServerOptions server_options;
+  std::string mount_options;
+  std::string output = "networkfs_bench.json";
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--iterations") {
+      iterations = std::stoul(argv[i + 1]);
+    } else if (flag == "--latency-us") {
+      server_options.latency = std::chrono::microseconds(std::stoll(argv[i + 1]));
+    } else if (flag == "--bandwidth") {
+      server_options.bandwidth = std::stoul(argv[i + 1]);
+    } else if (flag == "--options") {
+      mount_options = argv[i + 1];
+    } else if (flag == "--output") {
+      output = argv[i + 1];
+    } else {
+      fprintf(stderr, "unknown flag %s\n", flag.c_str());
+      return 1;
+    }
+  }
+
+  Environment environment(server_options);
+  environment.SetUp();
+  if (!mount_options.empty()) {
+    nfs_endpoint.mount_options += (nfs_endpoint.mount_options.empty() ? "" : ",") + mount_options;
+  }
+
+  auto nothing = [](NfsBucket&) {};
+  std::vector<Result> results;
+  try {
+    results.push_back(run("create_unlink", iterations, nothing, [](size_t) {
+      create_file("file");
+      check(unlink("file") == 0, "unlink");
+    }));
+
+    results.push_back(run("readdir_16", iterations, [](NfsBucket& nfs) {
+      nfs.clear();
+      for (int i = 0; i < 16; i++) {
+        nfs.create(ROOT_INO, "file" + std::to_string(i), EntryType::FILE);
+      }
+    }, [](size_t) {
+      DIR* dir = opendir(".");
+      check(dir != nullptr, "opendir");
+      size_t entries = 0;
+      while (readdir(dir) != nullptr) {
+        entries++;
+      }
+      closedir(dir);
+      check(entries == 18, "readdir");
+    }));
+
+    results.push_back(run("stat", iterations, nothing, [](size_t i) {
+      struct stat st;
+      check(stat(i % 2 == 0 ? "file1" : "file2", &st) == 0, "stat");
+    }));
+
+    results.push_back(run("open_read_close", iterations, nothing, [](size_t i) {
+      char buffer[4096];
+      int fd = open(i % 2 == 0 ? "file1" : "file2", O_RDONLY);
+      check(fd >= 0, "open");
+      check(read(fd, buffer, sizeof(buffer)) > 0, "read");
+      check(close(fd) == 0, "close");
+    }));
+
+    results.push_back(run("write_close", iterations, nothing, [](size_t) {
+      std::string content(512, 'a');
+      int fd = open("file1", O_WRONLY | O_TRUNC);
+      check(fd >= 0, "open");
+      for (size_t done = 0; done < content.size(); done += 64) {
+        check(write(fd, content.data() + done, 64) == 64, "write");
+      }
+      check(close(fd) == 0, "close");
+    }));
+
+    results.push_back(run("link_unlink", iterations, nothing, [](size_t) {
+      check(link("file1", "link") == 0, "link");
+      check(unlink("link") == 0, "unlink");
+    }));
+  } catch (const std::exception& e) {
+    fprintf(stderr, "error: %s\n", e.what());
+    environment.TearDown();
+    return 1;
+  }
+  environment.TearDown();
+
+  std::ofstream json(output);
+  json << "{\n  \"iterations\": " << iterations
+       << ",\n  \"latency_us\": " << server_options.latency.count()
+       << ",\n  \"bandwidth\": " << server_options.bandwidth
+       << ",\n  \"options\": \"" << mount_options << "\",\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    json << "    {\"name\": \"" << result.name << "\", \"ops\": " << result.ops
+         << ", \"ops_per_sec\": " << result.ops / result.seconds
+         << ", \"p50_us\": " << result.p50_us << ", \"p99_us\": " << result.p99_us << "}"
+         << (i + 1 < results.size() ? ",\n" : "\n");
+    printf("%-16s %10.0f ops/s  p50 %8.1f us  p99 %8.1f us\n", result.name.c_str(),
+           result.ops / result.seconds, result.p50_us, result.p99_us);
+  }
+  json << "  ]\n}\n";
+  return 0;
+}
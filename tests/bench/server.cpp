@@ -0,0 +1,39 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+#include "lib/server.hpp"
+
+/*
+ * Usage: networkfs_server [port] [latency in us] [bandwidth in B/s] [error rate]
+ *
+ * Then mount with: mount -t networkfs -o server=127.0.0.1,port=<port> <token> <dir>
+ * where the token is the last 36 bytes of /teaching/os/networkfs/v1/token/issue.
+ */
+int main(int argc, char **argv) {
+  NfsServerOptions options;
+  int port = argc > 1 ? atoi(argv[1]) : 8080;
+  if (argc > 2) {
+    options.latency = std::chrono::microseconds(atoll(argv[2]));
+  }
+  if (argc > 3) {
+    options.bandwidth = atoll(argv[3]);
+  }
+  if (argc > 4) {
+    options.error_rate = atof(argv[4]);
+  }
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  NfsServer server(options);
+  std::cerr << "Listening on 127.0.0.1:" << server.start("127.0.0.1", port) << std::endl;
+
+  int signal;
+  sigwait(&signals, &signal);
+  server.stop();
+  return 0;
+}
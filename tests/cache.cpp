@@ -0,0 +1,149 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+class CacheTest : public NfsTest {};
+
+/* Entries live in dcache for at most `entry_timeout` (1 second by default). */
+constexpr auto ENTRY_EXPIRED = std::chrono::milliseconds(1'500);
+
+TEST_F(CacheTest, EntryExpires) {
+  ASSERT_TRUE(fs::exists({"file1"}));
+
+  nfs.unlink(ROOT_INO, "file1");
+  std::this_thread::sleep_for(ENTRY_EXPIRED);
+
+  ASSERT_FALSE(fs::exists({"file1"}));
+}
+
+TEST_F(CacheTest, EntryReplaced) {
+  ASSERT_TRUE(fs::is_regular_file({"file1"}));
+
+  nfs.unlink(ROOT_INO, "file1");
+  nfs.create(ROOT_INO, "file1", EntryType::DIRECTORY);
+  std::this_thread::sleep_for(ENTRY_EXPIRED);
+
+  ASSERT_TRUE(fs::is_directory({"file1"}));
+}
+
+TEST_F(CacheTest, RemovedLocally) {
+  ASSERT_TRUE(fs::exists({"file1"}));
+  ASSERT_NO_THROW(fs::remove({"file1"}));
+  ASSERT_FALSE(fs::exists({"file1"}));
+
+  std::fstream fs;
+  fs.open("file1", std::ios::out);
+  ASSERT_FALSE(fs.fail());
+  fs.close();
+
+  ASSERT_TRUE(fs::is_regular_file({"file1"}));
+}
+
+TEST_F(CacheTest, NegativeExpires) {
+  ASSERT_FALSE(fs::exists({"file3"}));
+
+  nfs.create(ROOT_INO, "file3", EntryType::FILE);
+  std::this_thread::sleep_for(ENTRY_EXPIRED);
+
+  ASSERT_TRUE(fs::exists({"file3"}));
+}
+
+TEST_F(CacheTest, NegativeInvalidatedByCreate) {
+  ASSERT_FALSE(fs::exists({"file3"}));
+
+  nfs.create(ROOT_INO, "file3", EntryType::FILE);
+  ASSERT_NO_THROW(fs::create_directory({"directory"}));
+
+  ASSERT_TRUE(fs::exists({"file3"}));
+}
+
+TEST_F(CacheTest, NegativeInvalidatedByLink) {
+  ASSERT_FALSE(fs::exists({"file3"}));
+
+  nfs.create(ROOT_INO, "file3", EntryType::FILE);
+  ASSERT_NO_THROW(fs::create_hard_link({"file1"}, {"file4"}));
+
+  ASSERT_TRUE(fs::exists({"file3"}));
+  ASSERT_TRUE(fs::exists({"file4"}));
+}
+
+TEST_F(CacheTest, ListAfterLocalChange) {
+  std::set<std::string> expected_files{"file1", "file2"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+
+  ASSERT_NO_THROW(fs::create_directory({"directory"}));
+  ASSERT_NO_THROW(fs::remove({"file1"}));
+
+  expected_files = {"file2", "directory"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+}
+
+TEST_F(CacheTest, ListExpires) {
+  std::set<std::string> expected_files{"file1", "file2"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+
+  nfs.create(ROOT_INO, "file3", EntryType::FILE);
+  std::this_thread::sleep_for(ENTRY_EXPIRED);
+
+  expected_files.insert("file3");
+  ASSERT_EQ(list_directory({"."}), expected_files);
+}
+
+TEST_F(CacheTest, ListPrefillsEntries) {
+  ino_t ino = nfs.create(ROOT_INO, "directory", EntryType::DIRECTORY).ino;
+  nfs.create(ino, "file", EntryType::FILE);
+
+  std::set<std::string> expected_files{"file1", "file2", "directory"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+
+  struct stat st;
+  ASSERT_EQ(stat("directory", &st), 0);
+  ASSERT_EQ(st.st_ino, ino);
+  ASSERT_TRUE(S_ISDIR(st.st_mode));
+
+  ASSERT_TRUE(fs::is_regular_file({"directory/file"}));
+}
+
+/* Counters of the mount in debugfs, empty if debugfs is not mounted. */
+std::map<std::string, long long> read_stats() {
+  struct stat st;
+  EXPECT_EQ(stat(TEST_ROOT.c_str(), &st), 0);
+  std::ifstream file("/sys/kernel/debug/networkfs/" +
+                     std::to_string(major(st.st_dev)) + ":" +
+                     std::to_string(minor(st.st_dev)) + "/stats");
+  std::map<std::string, long long> stats;
+  std::string name;
+  long long value;
+  while (file >> name >> value) {
+    stats[name] = value;
+  }
+  return stats;
+}
+
+TEST_F(CacheTest, Stats) {
+  auto before = read_stats();
+  if (before.empty()) {
+    GTEST_SKIP() << "debugfs is not available";
+  }
+
+  list_directory({"."});
+  list_directory({"."});
+
+  auto after = read_stats();
+  ASSERT_GT(after["calls.list"], before["calls.list"]);
+  ASSERT_GT(after["cache.listing.hits"], before["cache.listing.hits"]);
+  ASSERT_GT(after["bytes_received"], before["bytes_received"]);
+  ASSERT_GT(after["connects"] + after["reused"],
+            before["connects"] + before["reused"]);
+}
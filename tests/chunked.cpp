@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Files are stored on the server as blocks of this size with "chunked". */
+constexpr size_t BLOCK_SIZE = 512;
+
+class ChunkedTest : public NfsLocalTest {
+public:
+  explicit ChunkedTest(const std::string& options = "chunked") : NfsLocalTest(options) {}
+
+  /* Content spanning several pages and more blocks than a single batch. */
+  static std::string pattern(size_t size) {
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+      content[i] = 'a' + (i * 7 + i / BLOCK_SIZE) % 26;
+    }
+    return content;
+  }
+
+  /* Stores @content on the server block by block. */
+  ino_t create_file(const std::string& name, const std::string& content) {
+    ino_t ino = nfs.create(ROOT_INO, name, EntryType::FILE).ino;
+    for (size_t offset = 0; offset < content.size(); offset += BLOCK_SIZE) {
+      EXPECT_EQ(nfs.write_block(ino, offset / BLOCK_SIZE, content.substr(offset, BLOCK_SIZE)).status, 0);
+    }
+    return ino;
+  }
+
+  /* Content of the file as the server has it. */
+  std::string server_content(ino_t ino) {
+    std::string content;
+    for (uint64_t block = 0;; block++) {
+      read_block_response response = nfs.read_block(ino, block);
+      EXPECT_EQ(response.status, 0);
+      content.append(response.content, response.length);
+      if (response.status != 0 || content.size() >= response.file_size) {
+        return content;
+      }
+    }
+  }
+};
+
+TEST_F(ChunkedTest, ReadMultiPage) {
+  std::string content = pattern(10 * 4096 + 100);
+  create_file("file", content);
+
+  ASSERT_EQ(read_file("file"), content);
+  ASSERT_EQ(fs::file_size("file"), content.size());
+}
+
+TEST_F(ChunkedTest, WriteMultiPage) {
+  std::string content = pattern(10 * 4096 + 100);
+  {
+    std::ofstream file("file", std::ios::binary);
+    file << content;
+    ASSERT_FALSE(file.fail());
+  }
+
+  ino_t ino = nfs.lookup(ROOT_INO, "file").ino;
+  ASSERT_EQ(server_content(ino), content);
+}
+
+TEST_F(ChunkedTest, OverwriteMiddleOfBlock) {
+  std::string content = pattern(4 * BLOCK_SIZE);
+  ino_t ino = create_file("file", content);
+
+  int fd = open("file", O_WRONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(pwrite(fd, "XYZ", 3, BLOCK_SIZE + 200), 3);
+  ASSERT_EQ(close(fd), 0);
+
+  content.replace(BLOCK_SIZE + 200, 3, "XYZ");
+  ASSERT_EQ(server_content(ino), content);
+  ASSERT_EQ(read_file("file"), content);
+}
+
+TEST_F(ChunkedTest, TruncateAcrossBlock) {
+  std::string content = pattern(3 * BLOCK_SIZE);
+  ino_t ino = create_file("file", content);
+
+  fs::resize_file("file", BLOCK_SIZE + 100);
+  content.resize(BLOCK_SIZE + 100);
+  ASSERT_EQ(server_content(ino), content);
+  ASSERT_EQ(read_file("file"), content);
+
+  /* Extended part reads as zeroes, also past the old end of the block. */
+  fs::resize_file("file", 2 * BLOCK_SIZE + 50);
+  content.resize(2 * BLOCK_SIZE + 50, '\0');
+  ASSERT_EQ(server_content(ino), content);
+  ASSERT_EQ(read_file("file"), content);
+}
+
+/* Blocks are uploaded as raw POST bodies. */
+class ChunkedPostTest : public ChunkedTest {
+public:
+  ChunkedPostTest() : ChunkedTest("chunked,post") {}
+};
+
+TEST_F(ChunkedPostTest, WriteBinary) {
+  /* Escaped into URLs, the file would be far beyond their length limit. */
+  std::string content(10 * 4096 + 100, '\0');
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<char>(255 - (i + i / BLOCK_SIZE) % 256);
+  }
+  {
+    std::ofstream file("file", std::ios::binary);
+    file << content;
+    ASSERT_FALSE(file.fail());
+  }
+
+  ino_t ino = nfs.lookup(ROOT_INO, "file").ino;
+  ASSERT_EQ(server_content(ino), content);
+  ASSERT_EQ(read_file("file"), content);
+}
+
+/* Fewer workers than readers, so that batches of several processes queue up. */
+class ParallelTest : public ChunkedTest {
+public:
+  ParallelTest() : ChunkedTest("chunked,workers=2") {}
+};
+
+TEST_F(ParallelTest, ReadFromSeveralProcesses) {
+  constexpr int READERS = 4;
+  std::vector<std::string> contents;
+  for (int i = 0; i < READERS; i++) {
+    /* Large enough for readahead to split reads into several batches. */
+    contents.push_back(pattern(64 * 4096 + i * 1000));
+    create_file("file" + std::to_string(i), contents.back());
+  }
+
+  std::vector<pid_t> readers;
+  for (int i = 0; i < READERS; i++) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      _exit(read_file("file" + std::to_string(i)) == contents[i] ? 0 : 1);
+    }
+    readers.push_back(pid);
+  }
+
+  for (pid_t pid : readers) {
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+  }
+}
@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <fstream>
 #include <sstream>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -230,6 +231,46 @@ TEST_F(FileTest, WriteSeek) {
   ASSERT_EQ(actual_content, expected_content);
 }
 
+TEST_F(FileTest, WriteMiddle) {
+  nfs.clear();
+  ino_t ino = nfs.create(ROOT_INO, "file", EntryType::FILE).ino;
+  nfs.write(ino, "hello-world");
+
+  int fd = open("file", O_WRONLY);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(pwrite(fd, "HELLO", 5, 0), 5);
+  ASSERT_EQ(close(fd), 0);
+
+  struct stat st;
+  ASSERT_EQ(stat("file", &st), 0);
+  ASSERT_EQ(st.st_size, 11);
+
+  read_response file = nfs.read(ino);
+  std::string actual_content = std::string(file.content, file.content + file.content_length);
+  ASSERT_EQ(actual_content, "HELLO-world");
+}
+
+TEST_F(FileTest, WriteManySmall) {
+  nfs.clear();
+
+  std::string expected_content;
+  std::fstream fs;
+  fs.open("file", std::ios::out);
+  ASSERT_FALSE(fs.fail());
+  for (int i = 0; i < 100; i++) {
+    std::string line = std::to_string(i) + "\n";
+    fs << line << std::flush;
+    expected_content += line;
+  }
+  fs.close();
+  ASSERT_FALSE(fs.fail());
+
+  ino_t ino = nfs.lookup(ROOT_INO, "file").ino;
+  read_response file = nfs.read(ino);
+  std::string actual_content = std::string(file.content, file.content + file.content_length);
+  ASSERT_EQ(actual_content, expected_content);
+}
+
 TEST_F(FileTest, Synchronize) {
   nfs.clear();
 
@@ -335,3 +376,54 @@ TEST_F(FileTest, WriteLonger) {
   fs.close();
   ASSERT_TRUE(fs.fail());
 }
+
+TEST_F(FileTest, ReadOnlyCloseDoesNotWrite) {
+  int fd = open("file1", O_RDONLY);
+  ASSERT_NE(fd, -1);
+  char out[128];
+  ASSERT_EQ(read(fd, out, sizeof(out)), 22);
+
+  ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+  nfs.write(ino, "changed");
+  ASSERT_EQ(close(fd), 0);
+
+  read_response file = nfs.read(ino);
+  std::string actual_content = std::string(file.content, file.content + file.content_length);
+  ASSERT_EQ(actual_content, "changed");
+}
+
+TEST_F(FileTest, SharedBetweenOpens) {
+  int writer = open("file1", O_WRONLY);
+  ASSERT_NE(writer, -1);
+  int reader = open("file1", O_RDONLY);
+  ASSERT_NE(reader, -1);
+
+  ASSERT_EQ(write(writer, "HELLO", 5), 5);
+
+  char out[128];
+  memset(out, 0, sizeof(out));
+  ASSERT_EQ(read(reader, out, sizeof(out)), 22);
+  ASSERT_STREQ(out, "HELLO world from file1");
+
+  ASSERT_EQ(close(reader), 0);
+  ASSERT_EQ(close(writer), 0);
+}
+
+TEST_F(FileTest, Mmap) {
+  int fd = open("file1", O_RDWR);
+  ASSERT_NE(fd, -1);
+
+  char *data = (char *)mmap(nullptr, 22, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ASSERT_NE(data, MAP_FAILED);
+  ASSERT_EQ(std::string(data, 22), "hello world from file1");
+
+  memcpy(data, "HELLO", 5);
+  ASSERT_EQ(munmap(data, 22), 0);
+  ASSERT_EQ(fsync(fd), 0);
+  ASSERT_EQ(close(fd), 0);
+
+  lookup_response response = nfs.lookup(ROOT_INO, "file1");
+  read_response file = nfs.read(response.ino);
+  std::string actual_content = std::string(file.content, file.content + file.content_length);
+  ASSERT_EQ(actual_content, "HELLO world from file1");
+}
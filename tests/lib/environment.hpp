@@ -0,0 +1,87 @@
+#ifndef NETWORKFS_TEST_ENVIRONMENT_HPP
+#define NETWORKFS_TEST_ENVIRONMENT_HPP
+
+#include <filesystem>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+
+#include "nfs.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Loads the module and starts the server the filesystem is mounted from. */
+class Environment : public ::testing::Environment {
+private:
+  bool unload_module = true;
+  bool delete_mountpoint = false;
+  NfsServer server;
+
+public:
+  explicit Environment(NfsServerOptions options = {}) : server(options) {}
+  ~Environment() override {}
+
+  void SetUp() override {
+    fs::path module_path("networkfs.ko");
+
+    if (!fs::exists(module_path)) {
+      throw std::runtime_error("Module networkfs is not built");
+    }
+
+    int fd = open(module_path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw std::runtime_error(std::string("Module networkfs is not accessible: ") + strerror(errno));
+    }
+
+    if (syscall(SYS_finit_module, fd, "", 0)) {
+      switch (errno) {
+        case EPERM:
+          throw std::runtime_error("Can not load module: Permission denied. Try re-running tests as root.");
+        case EEXIST:
+          std::cerr << "warning: using already loaded module" << std::endl;
+          unload_module = false;
+          break;
+        default:
+          throw std::runtime_error(std::string("Can not load module: ") + strerror(errno));
+      }
+    }
+
+    if (close(fd)) {
+      std::cerr << "warning: could not close module file" << std::endl;
+    }
+
+    if (!fs::exists(TEST_ROOT)) {
+      fs::create_directories(TEST_ROOT);
+      delete_mountpoint = true;
+    }
+
+    // Tests run against a local server unless NETWORKFS_TEST_REMOTE is set,
+    // then the public one is used
+    if (getenv("NETWORKFS_TEST_REMOTE") == nullptr) {
+      nfs_endpoint.host = "127.0.0.1";
+      nfs_endpoint.port = server.start(nfs_endpoint.host);
+      nfs_endpoint.mount_options = "server=" + nfs_endpoint.host + ",port=" + std::to_string(nfs_endpoint.port);
+    }
+  }
+
+  void TearDown() override {
+    server.stop();
+
+    if (delete_mountpoint) {
+      fs::remove(TEST_ROOT);
+    }
+
+    if (unload_module) {
+      if (syscall(SYS_delete_module, "networkfs", 0)) {
+        throw std::runtime_error(std::string("Can not unload module:") + strerror(errno));
+      }
+    }
+  }
+};
+
+#endif
@@ -8,13 +8,19 @@
 
 namespace fs = std::filesystem;
 
-NfsBucket::NfsBucket() : client("nerc.itmo.ru", 80) {}
+NfsEndpoint nfs_endpoint;
 
-void NfsBucket::initialize() {
+NfsBucket::NfsBucket() : client(nfs_endpoint.host, nfs_endpoint.port) {}
+
+void NfsBucket::initialize(const std::string& options) {
   auto response = issue();
   this->token_ = std::string(response.token, response.token + sizeof(response.token));
 
-  if (mount(this->token_.data(), TEST_ROOT.c_str(), "networkfs", 0, "")) {
+  std::string all_options = nfs_endpoint.mount_options;
+  if (!options.empty()) {
+    all_options += (all_options.empty() ? "" : ",") + options;
+  }
+  if (mount(this->token_.data(), TEST_ROOT.c_str(), "networkfs", 0, all_options.c_str())) {
     throw std::runtime_error(std::string("Filesystem can not be mounted: ") + strerror(errno));
   }
 
@@ -26,6 +32,9 @@ const std::string NfsBucket::token() const {
 }
 
 void NfsBucket::unmount(bool do_throw) {
+  if (!this->mounted) {
+    return;
+  }
   this->mounted = false;
 
   for (int i = 0; i < 5; i++) {
@@ -186,3 +195,28 @@ struct lookup_response NfsBucket::lookup(ino_t parent, const std::string& name)
     )
   );
 }
+
+struct read_block_response NfsBucket::read_block(ino_t inode, uint64_t block) {
+  return convert<read_block_response>(
+    call_api(
+      "fs/read_block",
+      {
+        {"inode", std::to_string(inode)},
+        {"block", std::to_string(block)}
+      }
+    )
+  );
+}
+
+struct empty_response NfsBucket::write_block(ino_t inode, uint64_t block, const std::string& content) {
+  return convert<empty_response>(
+    call_api(
+      "fs/write_block",
+      {
+        {"inode", std::to_string(inode)},
+        {"block", std::to_string(block)},
+        {"content", content}
+      }
+    )
+  );
+}
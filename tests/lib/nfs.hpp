@@ -26,6 +26,13 @@ struct list_response {
   } entries[16];
 };
 
+struct list_page_response {
+  uint64_t status;
+  size_t entries_count;
+  size_t total_count;
+  list_response::entry entries[16];
+};
+
 struct create_response {
   uint64_t status;
   ino_t ino;
@@ -37,6 +44,13 @@ struct read_response {
   char content[512];
 };
 
+struct read_block_response {
+  uint64_t status;
+  uint64_t file_size;
+  uint64_t length;
+  char content[512];
+};
+
 struct empty_response {
   uint64_t status;
 };
@@ -47,6 +61,15 @@ struct lookup_response {
   ino_t ino;
 };
 
+/* Where the API is served, set up by the test environment. */
+struct NfsEndpoint {
+  std::string host = "nerc.itmo.ru";
+  int port = 80;
+  std::string mount_options; /* Passed to mount(2) so that the module uses the same server */
+};
+
+extern NfsEndpoint nfs_endpoint;
+
 class NfsBucket {
 private:
   bool mounted = false;
@@ -65,7 +88,7 @@ public:
 
   const std::string token() const;
 
-  void initialize();
+  void initialize(const std::string& = ""); /* Mounts with the given options */
   void unmount(bool);
 
   ~NfsBucket();
@@ -79,6 +102,8 @@ public:
   struct empty_response unlink(ino_t, const std::string&);
   struct empty_response rmdir(ino_t, const std::string&);
   struct lookup_response lookup(ino_t, const std::string&);
+  struct read_block_response read_block(ino_t, uint64_t);
+  struct empty_response write_block(ino_t, uint64_t, const std::string&);
 
   void clear(ino_t = ROOT_INO); /* Empties whole filesystem */
 };
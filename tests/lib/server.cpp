@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "server.hpp"
+
+namespace {
+
+constexpr size_t PAGE_ENTRIES = 16;
+constexpr size_t MAX_NAME = 255;
+constexpr size_t MAX_CONTENT = 512;
+constexpr size_t BLOCK_SIZE = 512;
+
+template<typename T> std::string to_body(const T& value) {
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string status_body(uint64_t status) {
+  return to_body(empty_response{status});
+}
+
+uint64_t number(const httplib::Request& req, const std::string& key) {
+  if (!req.has_param(key)) {
+    throw std::invalid_argument("missing parameter " + key);
+  }
+  return std::stoull(req.get_param_value(key));
+}
+
+std::string string(const httplib::Request& req, const std::string& key) {
+  if (!req.has_param(key)) {
+    throw std::invalid_argument("missing parameter " + key);
+  }
+  return req.get_param_value(key);
+}
+
+/* Content is sent either as an argument or as a raw POST body. */
+std::string content(const httplib::Request& req) {
+  if (req.get_header_value("Content-Type").starts_with("application/octet-stream")) {
+    return req.body;
+  }
+  return string(req, "content");
+}
+
+}
+
+NfsServer::NfsServer(NfsServerOptions options) : options(options), random(options.seed) {
+  auto handler = [this](const httplib::Request& req, httplib::Response& res) {
+    handle(req, res);
+  };
+  std::string pattern = std::string(API_BASE) + ".*";
+  server.Get(pattern, handler);
+  server.Post(pattern, handler);
+  // The module keeps connections open and pipelines requests over them
+  server.set_keep_alive_max_count(1'000'000);
+  server.set_keep_alive_timeout(60);
+}
+
+int NfsServer::start(const std::string& host, int port) {
+  port_ = port == 0 ? server.bind_to_any_port(host) : (server.bind_to_port(host, port) ? port : -1);
+  if (port_ < 0) {
+    throw std::runtime_error("Server can not listen on " + host + ":" + std::to_string(port));
+  }
+  thread = std::thread([this]() { server.listen_after_bind(); });
+  server.wait_until_ready();
+  return port_;
+}
+
+void NfsServer::stop() {
+  if (thread.joinable()) {
+    server.stop();
+    thread.join();
+  }
+}
+
+int NfsServer::port() const {
+  return port_;
+}
+
+NfsServer::~NfsServer() {
+  stop();
+}
+
+void NfsServer::delay(size_t bytes) {
+  auto duration = options.latency;
+  if (options.bandwidth != 0) {
+    duration += std::chrono::microseconds(bytes * 1'000'000 / options.bandwidth);
+  }
+  if (duration.count() > 0) {
+    std::this_thread::sleep_for(duration);
+  }
+}
+
+void NfsServer::handle(const httplib::Request& req, httplib::Response& res) {
+  std::string path = req.path.substr(API_BASE.size());
+  std::string body;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (options.error_rate > 0 && std::uniform_real_distribution<>()(random) < options.error_rate) {
+      res.status = 503;
+      return;
+    }
+
+    try {
+      size_t slash = path.find('/');
+      if (path == "token/issue") {
+        body = issue();
+      } else if (slash != std::string::npos && path.compare(slash, 4, "/fs/") == 0
+                 && buckets.contains(path.substr(0, slash))) {
+        body = call(buckets[path.substr(0, slash)], path.substr(slash + 4), req);
+      } else {
+        res.status = 404;
+        return;
+      }
+    } catch (const std::exception&) {
+      // Missing or malformed arguments
+      res.status = 400;
+      return;
+    }
+  }
+
+  // Calls wait outside of the lock, so that slow ones do not serialize others
+  delay(req.target.size() + req.body.size() + body.size());
+  res.set_content(body, "application/octet-stream");
+}
+
+std::string NfsServer::issue() {
+  char token[37];
+  snprintf(token, sizeof(token), "00000000-0000-4000-8000-%012zx", ++issued);
+
+  Bucket& bucket = buckets[token];
+  Inode& root = bucket.inodes[ROOT_INO] = Inode{EntryType::DIRECTORY, 1};
+  for (std::string name : {"file1", "file2"}) {
+    ino_t ino = bucket.next_ino++;
+    bucket.inodes[ino] = Inode{EntryType::FILE, 1, "hello world from " + name};
+    root.entries[name] = ino;
+  }
+
+  token_response response{};
+  memcpy(response.token, token, sizeof(response.token));
+  return to_body(response);
+}
+
+std::string NfsServer::call(Bucket& bucket, const std::string& method, const httplib::Request& req) {
+  auto find = [&](const std::string& key, Inode*& inode) -> uint64_t {
+    auto it = bucket.inodes.find(number(req, key));
+    if (it == bucket.inodes.end()) {
+      return NFS_ENOENT;
+    }
+    inode = &it->second;
+    return NFS_OK;
+  };
+  auto find_directory = [&](const std::string& key, Inode*& inode) -> uint64_t {
+    uint64_t status = find(key, inode);
+    if (status == NFS_OK && inode->type != EntryType::DIRECTORY) {
+      return NFS_ENOTDIR;
+    }
+    return status;
+  };
+  auto find_file = [&](const std::string& key, Inode*& inode) -> uint64_t {
+    uint64_t status = find(key, inode);
+    if (status == NFS_OK && inode->type != EntryType::FILE) {
+      return NFS_ENOTFILE;
+    }
+    return status;
+  };
+  // Adds an entry for @ino to @parent, checking the limits of directories
+  auto add_entry = [&](Inode* parent, const std::string& name, ino_t ino) -> uint64_t {
+    if (name.size() > MAX_NAME) {
+      return NFS_ENAMETOOLONG;
+    }
+    if (parent->entries.contains(name)) {
+      return NFS_EEXIST;
+    }
+    if (parent->entries.size() >= options.max_entries) {
+      return NFS_ENOSPC_DIR;
+    }
+    parent->entries[name] = ino;
+    bucket.inodes[ino].links++;
+    return NFS_OK;
+  };
+
+  Inode* inode = nullptr;
+  Inode* parent = nullptr;
+  uint64_t status;
+
+  if (method == "list") {
+    list_response response{};
+    if ((response.status = find_directory("inode", inode)) == NFS_OK) {
+      if (inode->entries.size() > PAGE_ENTRIES) {
+        response.status = NFS_EFBIG;
+        return to_body(response);
+      }
+      for (const auto& [name, ino] : inode->entries) {
+        auto& entry = response.entries[response.entries_count++];
+        entry.entry_type = bucket.inodes[ino].type;
+        entry.ino = ino;
+        strncpy(entry.name, name.c_str(), sizeof(entry.name));
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "list_page") {
+    list_page_response response{};
+    if ((response.status = find_directory("inode", inode)) == NFS_OK) {
+      // Entries are ordered by name, so offsets stay valid between pages
+      uint64_t offset = number(req, "offset");
+      response.total_count = inode->entries.size();
+      auto it = inode->entries.begin();
+      std::advance(it, std::min<uint64_t>(offset, inode->entries.size()));
+      for (; it != inode->entries.end() && response.entries_count < PAGE_ENTRIES; it++) {
+        auto& entry = response.entries[response.entries_count++];
+        entry.entry_type = bucket.inodes[it->second].type;
+        entry.ino = it->second;
+        strncpy(entry.name, it->first.c_str(), sizeof(entry.name));
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "lookup") {
+    lookup_response response{};
+    if ((response.status = find_directory("parent", parent)) == NFS_OK) {
+      auto it = parent->entries.find(string(req, "name"));
+      if (it == parent->entries.end()) {
+        response.status = NFS_ENOENT_DIR;
+      } else {
+        response.entry_type = bucket.inodes[it->second].type;
+        response.ino = it->second;
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "create") {
+    create_response response{};
+    std::string type = string(req, "type");
+    if (type != "file" && type != "directory") {
+      throw std::invalid_argument("unknown type " + type);
+    }
+    if ((response.status = find_directory("parent", parent)) == NFS_OK) {
+      ino_t ino = bucket.next_ino;
+      response.status = add_entry(parent, string(req, "name"), ino);
+      if (response.status == NFS_OK) {
+        bucket.inodes[ino].type = type == "file" ? EntryType::FILE : EntryType::DIRECTORY;
+        bucket.next_ino++;
+        response.ino = ino;
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "link") {
+    if ((status = find_file("source", inode)) != NFS_OK) {
+      return status_body(status);
+    }
+    if ((status = find_directory("parent", parent)) != NFS_OK) {
+      return status_body(status);
+    }
+    return status_body(add_entry(parent, string(req, "name"), number(req, "source")));
+  }
+
+  if (method == "unlink" || method == "rmdir") {
+    if ((status = find_directory("parent", parent)) != NFS_OK) {
+      return status_body(status);
+    }
+    auto it = parent->entries.find(string(req, "name"));
+    if (it == parent->entries.end()) {
+      return status_body(NFS_ENOENT_DIR);
+    }
+    ino_t ino = it->second;
+    Inode& child = bucket.inodes[ino];
+    if (method == "unlink" && child.type != EntryType::FILE) {
+      return status_body(NFS_ENOTFILE);
+    }
+    if (method == "rmdir" && child.type != EntryType::DIRECTORY) {
+      return status_body(NFS_ENOTDIR);
+    }
+    if (!child.entries.empty()) {
+      return status_body(NFS_ENOTEMPTY);
+    }
+    parent->entries.erase(it);
+    if (--child.links == 0) {
+      bucket.inodes.erase(ino);
+    }
+    return status_body(NFS_OK);
+  }
+
+  if (method == "read") {
+    read_response response{};
+    if ((response.status = find_file("inode", inode)) == NFS_OK) {
+      if (inode->content.size() > MAX_CONTENT) {
+        response.status = NFS_EFBIG;
+      } else {
+        response.content_length = inode->content.size();
+        memcpy(response.content, inode->content.data(), inode->content.size());
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "write") {
+    if ((status = find_file("inode", inode)) != NFS_OK) {
+      return status_body(status);
+    }
+    std::string data = content(req);
+    if (data.size() > MAX_CONTENT) {
+      return status_body(NFS_EFBIG);
+    }
+    inode->content = data;
+    return status_body(NFS_OK);
+  }
+
+  if (method == "read_block") {
+    read_block_response response{};
+    if ((response.status = find_file("inode", inode)) == NFS_OK) {
+      uint64_t offset = number(req, "block") * BLOCK_SIZE;
+      response.file_size = inode->content.size();
+      if (offset < inode->content.size()) {
+        response.length = std::min(BLOCK_SIZE, inode->content.size() - offset);
+        memcpy(response.content, inode->content.data() + offset, response.length);
+      }
+    }
+    return to_body(response);
+  }
+
+  if (method == "write_block") {
+    if ((status = find_file("inode", inode)) != NFS_OK) {
+      return status_body(status);
+    }
+    uint64_t offset = number(req, "block") * BLOCK_SIZE;
+    std::string data = content(req);
+    if (data.size() > BLOCK_SIZE) {
+      return status_body(NFS_EFBIG);
+    }
+    // Writes past the end extend the file with zeroes
+    if (inode->content.size() < offset + data.size()) {
+      inode->content.resize(offset + data.size());
+    }
+    inode->content.replace(offset, data.size(), data);
+    return status_body(NFS_OK);
+  }
+
+  if (method == "truncate") {
+    if ((status = find_file("inode", inode)) != NFS_OK) {
+      return status_body(status);
+    }
+    inode->content.resize(number(req, "size"));
+    return status_body(NFS_OK);
+  }
+
+  throw std::invalid_argument("unknown method " + method);
+}
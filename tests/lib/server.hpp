@@ -0,0 +1,94 @@
+#ifndef NETWORKFS_TEST_SERVER_HPP
+#define NETWORKFS_TEST_SERVER_HPP
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <httplib.h>
+
+#include "nfs.hpp"
+
+/* Statuses of the API, returned in the first 8 bytes of a response. */
+enum NfsStatus : uint64_t {
+  NFS_OK = 0,
+  NFS_ENOENT = 1,       /* No inode with such number */
+  NFS_ENOTFILE = 2,     /* Inode is not a regular file */
+  NFS_ENOTDIR = 3,      /* Inode is not a directory */
+  NFS_ENOENT_DIR = 4,   /* No entry with such name in the directory */
+  NFS_EEXIST = 5,       /* Entry with such name already exists */
+  NFS_EFBIG = 6,        /* File or block content is too long */
+  NFS_ENOSPC_DIR = 7,   /* Directory already has max_entries entries */
+  NFS_ENOTEMPTY = 8,    /* Directory is not empty */
+  NFS_ENAMETOOLONG = 9, /* Name is longer than 255 bytes */
+};
+
+struct NfsServerOptions {
+  /* Added to every call before it is answered. */
+  std::chrono::microseconds latency{0};
+  /* Bytes per second of requests and responses together, 0 for no limit. */
+  size_t bandwidth = 0;
+  /* Share of calls answered with HTTP 503 instead of being made. */
+  double error_rate = 0;
+  /* Seed of injected errors, so that runs are reproducible. */
+  unsigned seed = 0;
+  /*
+   * Entries a directory may have. Directories with more than 16 of them can
+   * only be listed by "list_page", "list" answers NFS_EFBIG for them.
+   */
+  size_t max_entries = 16;
+};
+
+/*
+ * In-memory implementation of the networkfs API, served over HTTP on a
+ * background thread. Every issued token gets its own bucket, prefilled like
+ * the public server does. Besides the public methods it implements the block
+ * methods used by the "chunked" mount option, "list_page" used by the "paged"
+ * one, and accepts POST bodies, both form-encoded and raw.
+ */
+class NfsServer {
+private:
+  struct Inode {
+    EntryType type = EntryType::FILE;
+    size_t links = 0;
+    std::string content;
+    std::map<std::string, ino_t> entries;
+  };
+
+  struct Bucket {
+    std::map<ino_t, Inode> inodes;
+    ino_t next_ino = ROOT_INO + 1;
+  };
+
+  NfsServerOptions options;
+  httplib::Server server;
+  std::thread thread;
+  int port_ = 0;
+
+  std::mutex mutex; /* Protects everything below */
+  std::map<std::string, Bucket> buckets;
+  std::mt19937 random;
+  size_t issued = 0;
+
+  void handle(const httplib::Request&, httplib::Response&);
+  std::string issue();
+  std::string call(Bucket&, const std::string&, const httplib::Request&);
+  void delay(size_t);
+
+public:
+  explicit NfsServer(NfsServerOptions = {});
+
+  NfsServer(const NfsServer&) = delete;
+  NfsServer& operator=(const NfsServer&) = delete;
+
+  /* Starts serving, port 0 picks a free one. Returns the port. */
+  int start(const std::string& = "127.0.0.1", int = 0);
+  void stop();
+  int port() const;
+
+  ~NfsServer();
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef NETWORKFS_TEST_TEST_HPP
 #define NETWORKFS_TEST_TEST_HPP
 
+#include <cstdlib>
 #include <filesystem>
+#include <string>
 
 #include <gtest/gtest.h>
 
@@ -16,10 +18,13 @@ public:
   NfsBucket nfs;
 
   NfsTest() : nfs() {};
+  explicit NfsTest(std::string options) : nfs(), options(std::move(options)) {};
 
 protected:
+  std::string options; /* Mount options of the suite */
+
   void SetUp() override {
-    nfs.initialize();
+    nfs.initialize(options);
     std::cerr << "Token for this run: " << nfs.token() << std::endl;
     previous_path = fs::current_path();
     fs::current_path(TEST_ROOT);
@@ -31,4 +36,31 @@ protected:
   }
 };
 
+/*
+ * Some options need methods only the local server implements, suites mounting
+ * with them are skipped against the public one.
+ */
+class NfsLocalTest : public NfsTest {
+private:
+  bool mounted = false;
+
+public:
+  explicit NfsLocalTest(std::string options) : NfsTest(std::move(options)) {}
+
+protected:
+  void SetUp() override {
+    if (getenv("NETWORKFS_TEST_REMOTE") != nullptr) {
+      GTEST_SKIP() << "The public server does not support " << options;
+    }
+    NfsTest::SetUp();
+    mounted = true;
+  }
+
+  void TearDown() override {
+    if (mounted) {
+      NfsTest::TearDown();
+    }
+  }
+};
+
 #endif
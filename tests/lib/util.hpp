@@ -3,6 +3,8 @@
 
 #include <algorithm>
 #include <filesystem>
+#include <set>
+#include <string>
 #include <string_view>
 
 namespace fs = std::filesystem;
@@ -13,4 +15,7 @@ const fs::path TEST_ROOT = fs::path("/mnt/networkfs-test");
 
 std::set<std::string> list_directory(const fs::path& path);
 
+/* Whole content of the file, binary. */
+std::string read_file(const fs::path& path);
+
 #endif
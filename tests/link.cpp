@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include <filesystem>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -65,3 +66,30 @@ TEST_F(LinkTest, OtherDirectory) {
     ASSERT_EQ(response.status, 0);
     ASSERT_EQ(response.ino, file);
 }
+
+TEST_F(LinkTest, SharedInode) {
+    ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+    nfs.link(ino, ROOT_INO, "file3");
+
+    struct stat st;
+    ASSERT_EQ(stat("file1", &st), 0);
+    ASSERT_EQ(stat("file3", &st), 0);
+    ASSERT_EQ(st.st_nlink, 2);
+
+    // Both names see writes through the other one without a server round trip
+    int fd = open("file1", O_WRONLY | O_TRUNC);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, "shared", 6), 6);
+
+    char buffer[16] = {};
+    int reader = open("file3", O_RDONLY);
+    ASSERT_GE(reader, 0);
+    ASSERT_EQ(read(reader, buffer, sizeof(buffer)), 6);
+    ASSERT_STREQ(buffer, "shared");
+    close(reader);
+    close(fd);
+
+    ASSERT_NO_THROW(fs::remove({"file3"}));
+    ASSERT_EQ(stat("file1", &st), 0);
+    ASSERT_EQ(st.st_nlink, 1);
+}
@@ -0,0 +1,86 @@
+#include <filesystem>
+#include <optional>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "lib/nfs.hpp"
+#include "lib/server.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/*
+ * Directories are mounted with the "paged" option from a server of their own,
+ * which allows more than 16 entries in a directory.
+ */
+class PagedTest : public testing::Test {
+public:
+  fs::path previous_path;
+  NfsEndpoint previous_endpoint;
+  NfsServer server{NfsServerOptions{.max_entries = 4096}};
+  std::optional<NfsBucket> nfs;
+
+protected:
+  void SetUp() override {
+    if (getenv("NETWORKFS_TEST_REMOTE") != nullptr) {
+      GTEST_SKIP() << "The public server does not implement list_page";
+    }
+    previous_endpoint = nfs_endpoint;
+    nfs_endpoint.port = server.start(nfs_endpoint.host);
+    nfs_endpoint.mount_options = "server=" + nfs_endpoint.host + ",port=" + std::to_string(nfs_endpoint.port) + ",paged";
+
+    nfs.emplace();
+    nfs->initialize();
+    previous_path = fs::current_path();
+    fs::current_path(TEST_ROOT);
+  }
+
+  void TearDown() override {
+    if (!nfs.has_value()) {
+      return;
+    }
+    fs::current_path(previous_path);
+    nfs->unmount(true);
+    nfs.reset();
+    server.stop();
+    nfs_endpoint = previous_endpoint;
+  }
+
+  std::set<std::string> create_files(ino_t parent, size_t count) {
+    std::set<std::string> names;
+    for (size_t i = 0; i < count; i++) {
+      std::string name = "test" + std::to_string(i);
+      EXPECT_EQ(nfs->create(parent, name, EntryType::FILE).status, 0);
+      names.insert(name);
+    }
+    return names;
+  }
+};
+
+TEST_F(PagedTest, ListDefaultFiles) {
+  std::set<std::string> expected_files{"file1", "file2"};
+  ASSERT_EQ(list_directory({"."}), expected_files);
+}
+
+TEST_F(PagedTest, ListEmpty) {
+  nfs->create(ROOT_INO, "dir", EntryType::DIRECTORY);
+
+  ASSERT_EQ(list_directory({"dir"}), std::set<std::string>{});
+}
+
+TEST_F(PagedTest, ListSeveralPages) {
+  ino_t ino = nfs->create(ROOT_INO, "dir", EntryType::DIRECTORY).ino;
+  std::set<std::string> expected_files = create_files(ino, 100);
+
+  ASSERT_EQ(list_directory({"dir"}), expected_files);
+  ASSERT_TRUE(fs::is_regular_file({"dir/test99"}));
+}
+
+/* Does not fit into a single getdents(2) buffer, so listing is resumed. */
+TEST_F(PagedTest, ListResumed) {
+  ino_t ino = nfs->create(ROOT_INO, "dir", EntryType::DIRECTORY).ino;
+  std::set<std::string> expected_files = create_files(ino, 3000);
+
+  ASSERT_EQ(list_directory({"dir"}), expected_files);
+}
@@ -0,0 +1,51 @@
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Content is uploaded as raw POST bodies instead of escaped arguments. */
+class PostTest : public NfsLocalTest {
+public:
+  PostTest() : NfsLocalTest("post") {}
+};
+
+/* Every byte value, most of which would have to be escaped in a URL. */
+std::string binary_content(size_t size) {
+  std::string content(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    content[i] = static_cast<char>(255 - i % 256);
+  }
+  return content;
+}
+
+TEST_F(PostTest, WriteBinary) {
+  /* Escaped, the largest file would take three times as much of the URL. */
+  std::string content = binary_content(512);
+  {
+    std::ofstream file("file", std::ios::binary);
+    file << content;
+    ASSERT_FALSE(file.fail());
+  }
+
+  read_response response = nfs.read(nfs.lookup(ROOT_INO, "file").ino);
+  ASSERT_EQ(response.status, 0);
+  ASSERT_EQ(std::string(response.content, response.content_length), content);
+  ASSERT_EQ(read_file("file"), content);
+}
+
+TEST_F(PostTest, Overwrite) {
+  {
+    std::ofstream file("file1", std::ios::binary | std::ios::trunc);
+    file << "a&b=c%d+e f";
+    ASSERT_FALSE(file.fail());
+  }
+
+  read_response response = nfs.read(nfs.lookup(ROOT_INO, "file1").ino);
+  ASSERT_EQ(response.status, 0);
+  ASSERT_EQ(std::string(response.content, response.content_length), "a&b=c%d+e f");
+}
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Mounted with prefetch=, so that files found by readdir are read ahead. */
+class PrefetchTest : public NfsTest {
+public:
+  PrefetchTest() : NfsTest("prefetch=4096") {}
+};
+
+/* Prefetch runs in the background, give it some time but less than attr_timeout. */
+constexpr auto PREFETCHED = std::chrono::milliseconds(300);
+constexpr auto EXPIRED = std::chrono::milliseconds(1'500);
+
+TEST_F(PrefetchTest, ReadAfterList) {
+  ino_t directory = nfs.create(ROOT_INO, "directory", EntryType::DIRECTORY).ino;
+  for (int i = 0; i < 8; i++) {
+    ino_t ino = nfs.create(directory, "file" + std::to_string(i), EntryType::FILE).ino;
+    nfs.write(ino, "content of file" + std::to_string(i));
+  }
+
+  list_directory({"directory"});
+  std::this_thread::sleep_for(PREFETCHED);
+
+  for (int i = 0; i < 8; i++) {
+    ASSERT_EQ(read_file("directory/file" + std::to_string(i)), "content of file" + std::to_string(i));
+  }
+}
+
+/* Open right after the listing is served from memory, as if it was the one of a previous open. */
+TEST_F(PrefetchTest, ServedFromMemory) {
+  ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+
+  list_directory({"."});
+  std::this_thread::sleep_for(PREFETCHED);
+  nfs.write(ino, "changed");
+
+  ASSERT_EQ(read_file("file1"), "hello world from file1");
+}
+
+TEST_F(PrefetchTest, Expires) {
+  ino_t ino = nfs.lookup(ROOT_INO, "file1").ino;
+
+  list_directory({"."});
+  std::this_thread::sleep_for(PREFETCHED);
+  nfs.write(ino, "changed");
+  std::this_thread::sleep_for(EXPIRED);
+
+  ASSERT_EQ(read_file("file1"), "changed");
+}
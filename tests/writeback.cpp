@@ -0,0 +1,58 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "lib/test.hpp"
+#include "lib/util.hpp"
+
+namespace fs = std::filesystem;
+
+/* Close does not wait for the upload, dirty files are written back later. */
+class WritebackTest : public NfsTest {
+public:
+  WritebackTest() : NfsTest("writeback=async") {}
+
+  void write_file(const fs::path& path, const std::string& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+    ASSERT_FALSE(file.fail());
+  }
+
+  std::string server_content(const std::string& name) {
+    read_response response = nfs.read(nfs.lookup(ROOT_INO, name).ino);
+    EXPECT_EQ(response.status, 0);
+    return std::string(response.content, response.content_length);
+  }
+};
+
+/* Files are written back a second after close (NETWORKFS_WRITEBACK_DELAY). */
+constexpr auto WRITTEN_BACK = std::chrono::milliseconds(2'500);
+
+TEST_F(WritebackTest, WrittenBackAfterDelay) {
+  write_file("file1", "new content");
+  /* Only the truncation on open is made right away. */
+  ASSERT_NE(server_content("file1"), "new content");
+
+  std::this_thread::sleep_for(WRITTEN_BACK);
+  ASSERT_EQ(server_content("file1"), "new content");
+}
+
+TEST_F(WritebackTest, ReadAfterClose) {
+  write_file("file1", "new content");
+
+  ASSERT_EQ(read_file("file1"), "new content");
+}
+
+TEST_F(WritebackTest, WrittenBackOnUnmount) {
+  write_file("file1", "new content");
+  write_file("file2", "other content");
+
+  fs::current_path(previous_path);
+  nfs.unmount(true);
+
+  ASSERT_EQ(server_content("file1"), "new content");
+  ASSERT_EQ(server_content("file2"), "other content");
+}
@@ -0,0 +1,3 @@
+// Tracepoints declared in trace.h are defined here, see Documentation/trace
+#define CREATE_TRACE_POINTS
+#include "trace.h"
@@ -0,0 +1,90 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM networkfs
+
+#if !defined(NETWORKFS_TRACE) || defined(TRACE_HEADER_MULTI_READ)
+#define NETWORKFS_TRACE
+
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+#include "http.h"
+
+// clang-format off
+
+// Events are reported when an operation finishes, @start is when it began.
+// Status is 0 on success, otherwise negated errno or status of the server.
+DECLARE_EVENT_CLASS(networkfs_inode_op,
+  TP_PROTO(struct inode *inode, u64 size, s64 status, ktime_t start),
+  TP_ARGS(inode, size, status, start),
+  TP_STRUCT__entry(
+    __field(dev_t, dev)
+    __field(u64, ino)
+    __field(u64, size)
+    __field(s64, status)
+    __field(s64, duration)
+  ),
+  TP_fast_assign(
+    __entry->dev = inode->i_sb->s_dev;
+    __entry->ino = inode->i_ino;
+    __entry->size = size;
+    __entry->status = status;
+    __entry->duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+  ),
+  TP_printk("dev %d:%d ino %llu size %llu status %lld duration %lld ns",
+            MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+            __entry->size, __entry->status, __entry->duration)
+);
+
+#define NETWORKFS_INODE_EVENT(name)                                       \
+  DEFINE_EVENT(networkfs_inode_op, name,                                  \
+    TP_PROTO(struct inode *inode, u64 size, s64 status, ktime_t start),   \
+    TP_ARGS(inode, size, status, start))
+
+// Size is the length of the name looked up in the directory
+NETWORKFS_INODE_EVENT(networkfs_lookup);
+// Size is the position in the directory reached
+NETWORKFS_INODE_EVENT(networkfs_iterate);
+// Size is the size of the file after it is revalidated
+NETWORKFS_INODE_EVENT(networkfs_open);
+// Size is the number of bytes read into page cache
+NETWORKFS_INODE_EVENT(networkfs_read);
+// Size is the number of bytes written back from page cache
+NETWORKFS_INODE_EVENT(networkfs_write);
+// Size is the number of bytes uploaded as the whole file
+NETWORKFS_INODE_EVENT(networkfs_save_buffer);
+
+// Reported for every call of a batch once it is answered or failed, calls
+// pipelined together share @start
+TRACE_EVENT(networkfs_http_call,
+  TP_PROTO(const struct networkfs_http_request *request, ktime_t start),
+  TP_ARGS(request, start),
+  TP_STRUCT__entry(
+    __string(method, request->method)
+    __field(u64, ino)
+    __field(u32, arg_size)
+    __field(u32, body_size)
+    __field(s64, status)
+    __field(s64, duration)
+  ),
+  TP_fast_assign(
+    __assign_str(method, request->method);
+    __entry->ino = networkfs_http_request_ino(request);
+    __entry->arg_size = request->arg_size;
+    __entry->body_size = request->body_size;
+    __entry->status = request->result;
+    __entry->duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+  ),
+  TP_printk("method %s ino %llu args %u body %u status %lld duration %lld ns",
+            __get_str(method), __entry->ino, __entry->arg_size,
+            __entry->body_size, __entry->status, __entry->duration)
+);
+
+// clang-format on
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>